@@ -0,0 +1,12 @@
+#include "stm32f10x.h"                  // Device header
+#include <stdint.h>
+
+#include "dwt.h"
+
+void DWT_Init(void)
+{
+    // TRCENA, the DWT is off until the trace block is enabled
+    CoreDebug->DEMCR |= 0x01000000;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= 1;
+}
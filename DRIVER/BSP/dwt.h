@@ -0,0 +1,18 @@
+#ifndef __DWT_H
+#define __DWT_H
+
+#include <stdint.h>
+
+// the CMSIS in this project predates the DWT definitions
+#define DWT_CTRL    (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT  (*(volatile uint32_t *)0xE0001004)
+
+// core cycle counter, used by the MIDI_STATS measurements
+void DWT_Init(void);
+
+static inline uint32_t DWT_GetCycles(void)
+{
+    return DWT_CYCCNT;
+}
+
+#endif
@@ -1,85 +1,149 @@
 #include "stm32f10x.h"                  // Device header
 #include <stdint.h>
 
-void PWM_Init(void)
+#include "pwm.h"
+#ifdef MIDI_STATS
+#include "dwt.h"
+#endif
+
+#ifdef MIDI_STATS
+uint32_t PWM_GlitchCount[PWM_VOICE_NUM];
+#endif
+
+#ifndef PWM_DMA_SEQ
+#ifdef MIDI_STATS
+uint32_t PWM_NoiseIrqCount = 0;
+uint32_t PWM_NoiseCycles = 0;
+uint32_t PWM_NoiseCyclesMax = 0;
+#endif
+
+static volatile uint16_t PWM_NoiseBase[PWM_VOICE_NUM];
+static volatile uint16_t PWM_NoiseSpread[PWM_VOICE_NUM];
+static uint16_t PWM_Lfsr = 0xACE1;
+#endif
+
+static void PWM_VoiceInit(const PWM_Voice *voice)
 {
-    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, ENABLE);
-    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM3, ENABLE);
-    RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA, ENABLE);
-
-    // TIM2_CH1
-    {
-        GPIO_InitTypeDef GPIO_InitStructure;
-        GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_PP;
-        GPIO_InitStructure.GPIO_Pin = GPIO_Pin_0;
-        GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
-        GPIO_Init(GPIOA, &GPIO_InitStructure);
-
-        TIM_InternalClockConfig(TIM2);
-
-        TIM_TimeBaseInitTypeDef TIM_TimeBaseInitStructure;
-        TIM_TimeBaseInitStructure.TIM_ClockDivision = TIM_CKD_DIV1;
-        TIM_TimeBaseInitStructure.TIM_CounterMode = TIM_CounterMode_Up;
-        TIM_TimeBaseInitStructure.TIM_Period = 499;     //ARR
-        TIM_TimeBaseInitStructure.TIM_Prescaler = 71;   //PSC
-        TIM_TimeBaseInitStructure.TIM_RepetitionCounter = 0;
-        TIM_TimeBaseInit(TIM2, &TIM_TimeBaseInitStructure);
-
-        TIM_OCInitTypeDef TIM_OCInitStructure;
-        TIM_OCStructInit(&TIM_OCInitStructure);
-        TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
-        TIM_OCInitStructure.TIM_OCPolarity = TIM_OCPolarity_High;
-        TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
-        TIM_OCInitStructure.TIM_Pulse = 0;  //CCR
-        TIM_OC1Init(TIM2, &TIM_OCInitStructure);
-
-        TIM_Cmd(TIM2, ENABLE);
+    GPIO_InitTypeDef GPIO_InitStructure;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_PP;
+    GPIO_InitStructure.GPIO_Pin = voice->GPIO_Pin;
+    GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_Init(voice->GPIOx, &GPIO_InitStructure);
+
+    TIM_InternalClockConfig(voice->TIMx);
+
+    TIM_TimeBaseInitTypeDef TIM_TimeBaseInitStructure;
+    TIM_TimeBaseInitStructure.TIM_ClockDivision = TIM_CKD_DIV1;
+    TIM_TimeBaseInitStructure.TIM_CounterMode = TIM_CounterMode_Up;
+    TIM_TimeBaseInitStructure.TIM_Period = 499;     //ARR
+    TIM_TimeBaseInitStructure.TIM_Prescaler = voice->Prescaler;   //PSC
+    TIM_TimeBaseInitStructure.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(voice->TIMx, &TIM_TimeBaseInitStructure);
+
+    TIM_OCInitTypeDef TIM_OCInitStructure;
+    TIM_OCStructInit(&TIM_OCInitStructure);
+    TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
+    TIM_OCInitStructure.TIM_OCPolarity = TIM_OCPolarity_High;
+    TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
+    TIM_OCInitStructure.TIM_Pulse = 0;  //CCR
+    TIM_OC1Init(voice->TIMx, &TIM_OCInitStructure);
+
+    // pitch changes land on the update event, see PWM_SetVoice
+    TIM_OC1PreloadConfig(voice->TIMx, TIM_OCPreload_Enable);
+    TIM_ARRPreloadConfig(voice->TIMx, ENABLE);
+
+    // the outputs of advanced timers stay off until MOE is set
+    if (voice->TIMx == TIM1) {
+        TIM_CtrlPWMOutputs(voice->TIMx, ENABLE);
     }
 
-    // TIM3_CH1
-    {
-        GPIO_InitTypeDef GPIO_InitStructure;
-        GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_PP;
-        GPIO_InitStructure.GPIO_Pin = GPIO_Pin_6;
-        GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
-        GPIO_Init(GPIOA, &GPIO_InitStructure);
-
-        TIM_InternalClockConfig(TIM3);
-
-        TIM_TimeBaseInitTypeDef TIM_TimeBaseInitStructure;
-        TIM_TimeBaseInitStructure.TIM_ClockDivision = TIM_CKD_DIV1;
-        TIM_TimeBaseInitStructure.TIM_CounterMode = TIM_CounterMode_Up;
-        TIM_TimeBaseInitStructure.TIM_Period = 499;     //ARR
-        TIM_TimeBaseInitStructure.TIM_Prescaler = 71;   //PSC
-        TIM_TimeBaseInitStructure.TIM_RepetitionCounter = 0;
-        TIM_TimeBaseInit(TIM3, &TIM_TimeBaseInitStructure);
-
-        TIM_OCInitTypeDef TIM_OCInitStructure;
-        TIM_OCStructInit(&TIM_OCInitStructure);
-        TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
-        TIM_OCInitStructure.TIM_OCPolarity = TIM_OCPolarity_High;
-        TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
-        TIM_OCInitStructure.TIM_Pulse = 0;  //CCR
-        TIM_OC1Init(TIM3, &TIM_OCInitStructure);
-
-        TIM_Cmd(TIM3, ENABLE);
+    TIM_Cmd(voice->TIMx, ENABLE);
+}
+
+void PWM_Init(void)
+{
+    uint8_t i;
+
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2 | RCC_APB1Periph_TIM3, ENABLE);
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM1 | RCC_APB2Periph_GPIOA, ENABLE);
+
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        PWM_VoiceInit(&PWM_Voices[i]);
     }
+
+#ifndef PWM_DMA_SEQ
+    // below the serial port, above the SysTick control tick
+    NVIC_InitTypeDef NVIC_InitStructure;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannel = TIM2_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
+    NVIC_InitStructure.NVIC_IRQChannel = TIM3_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
+    NVIC_InitStructure.NVIC_IRQChannel = TIM1_UP_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
+#endif
 }
 
-void PWM_SetCompare1(uint8_t No, uint16_t Compare)
+#ifndef PWM_DMA_SEQ
+void PWM_NoiseStart(uint8_t No, uint16_t Autoreload, uint16_t Spread)
 {
-    if (No == 0) {
-	    TIM_SetCompare1(TIM2, Compare);
-    } else {
-	    TIM_SetCompare1(TIM3, Compare);
+    TIM_TypeDef *TIMx = PWM_Voices[No].TIMx;
+    // shortest period the rate cap allows with the current prescaler
+    uint32_t minTicks = 72000000 / PWM_NOISE_MAX_HZ / (TIMx->PSC + 1);
+
+    if (Autoreload + 1u < minTicks) {
+        Autoreload = minTicks - 1;
+    }
+    while ((uint32_t)Autoreload + Spread > 0xffff) {
+        Spread >>= 1;
     }
+    PWM_NoiseBase[No] = Autoreload;
+    PWM_NoiseSpread[No] = Spread;
+    TIMx->DIER |= TIM_DIER_UIE;
+}
+
+void PWM_NoiseStop(uint8_t No)
+{
+    PWM_Voices[No].TIMx->DIER &= (uint16_t)~TIM_DIER_UIE;
 }
 
-void PWM_SetAutoreload(uint8_t No, uint16_t Autoreload)
+// 16 bit Galois LFSR, one step per update event of a noise voice,
+// the new ARR is preloaded and starts with the next period
+static inline void PWM_NoiseUpdate(uint8_t No)
 {
-    if (No == 0) {
-        TIM_SetAutoreload(TIM2, Autoreload);
-    } else {
-        TIM_SetAutoreload(TIM3, Autoreload);
+#ifdef MIDI_STATS
+    uint32_t cycles = DWT_GetCycles();
+#endif
+    TIM_TypeDef *TIMx = PWM_Voices[No].TIMx;
+
+    TIMx->SR = (uint16_t)~TIM_SR_UIF;
+    PWM_Lfsr = (PWM_Lfsr >> 1) ^ (-(PWM_Lfsr & 1u) & 0xB400u);
+    TIMx->ARR = PWM_NoiseBase[No] + (PWM_Lfsr & PWM_NoiseSpread[No]);
+
+#ifdef MIDI_STATS
+    cycles = DWT_GetCycles() - cycles;
+    PWM_NoiseIrqCount += 1;
+    PWM_NoiseCycles += cycles;
+    if (cycles > PWM_NoiseCyclesMax) {
+        PWM_NoiseCyclesMax = cycles;
     }
-}
\ No newline at end of file
+#endif
+}
+
+void TIM2_IRQHandler(void)
+{
+    PWM_NoiseUpdate(0);
+}
+
+void TIM3_IRQHandler(void)
+{
+    PWM_NoiseUpdate(1);
+}
+
+void TIM1_UP_IRQHandler(void)
+{
+    PWM_NoiseUpdate(2);
+}
+#endif
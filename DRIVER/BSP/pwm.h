@@ -2,9 +2,96 @@
 #define __PWM_H
 
 #include <stdint.h>
+#include "stm32f10x.h"
+
+// one buzzer per timer, all on CH1, the timers are clocked at 72MHz
+typedef struct {
+    TIM_TypeDef *TIMx;
+    GPIO_TypeDef *GPIOx;
+    uint16_t GPIO_Pin;
+    uint16_t Prescaler;
+} PWM_Voice;
+
+#ifdef PWM_DMA_SEQ
+// TIM1 is the step clock of the DMA sequencer, see seq.h
+#define PWM_VOICE_NUM 2
+#else
+#define PWM_VOICE_NUM 3
+#endif
+
+// the table is static const in the header on purpose:
+// with a constant index the compiler folds the lookup
+// and a voice write becomes a single register store
+static const PWM_Voice PWM_Voices[PWM_VOICE_NUM] = {
+    {TIM2, GPIOA, GPIO_Pin_0, 71},  // TIM2_CH1
+    {TIM3, GPIOA, GPIO_Pin_6, 71},  // TIM3_CH1
+#ifndef PWM_DMA_SEQ
+    {TIM1, GPIOA, GPIO_Pin_8, 71},  // TIM1_CH1, advanced timer, needs MOE
+#endif
+};
+
+#ifdef MIDI_STATS
+// writes that would have glitched without ARR preload
+extern uint32_t PWM_GlitchCount[PWM_VOICE_NUM];
+#endif
+
+#ifndef PWM_DMA_SEQ
+// Noise: while on, every update event of the voice reloads ARR with
+// Autoreload + (LFSR & Spread). The update rate is capped, which bounds
+// the interrupt load of a noise voice.
+#define PWM_NOISE_MAX_HZ    16000
+
+#ifdef MIDI_STATS
+extern uint32_t PWM_NoiseIrqCount;
+extern uint32_t PWM_NoiseCycles;    // spent in the noise interrupts
+extern uint32_t PWM_NoiseCyclesMax; // longest single interrupt
+#endif
+#endif
 
 void PWM_Init(void);
-void PWM_SetCompare1(uint8_t No, uint16_t Compare);
-void PWM_SetAutoreload(uint8_t No, uint16_t Autoreload);
+#ifndef PWM_DMA_SEQ
+// Spread is a mask, e.g. 0x3ff for up to 1023 ticks more
+void PWM_NoiseStart(uint8_t No, uint16_t Autoreload, uint16_t Spread);
+void PWM_NoiseStop(uint8_t No);
+#endif
+
+static inline void PWM_SetCompare1(uint8_t No, uint16_t Compare)
+{
+    PWM_Voices[No].TIMx->CCR1 = Compare;
+}
+
+static inline void PWM_SetAutoreload(uint8_t No, uint16_t Autoreload)
+{
+    PWM_Voices[No].TIMx->ARR = Autoreload;
+}
+
+// PSC, ARR and CCR1 are preloaded, the new set takes effect together at
+// the next update event, after the running period is finished.
+// UDIS holds the update off while the registers are written so a
+// period can't start with the new ARR and the old CCR1.
+static inline void PWM_SetVoice(uint8_t No, uint16_t Prescaler, uint16_t Autoreload, uint16_t Compare)
+{
+    TIM_TypeDef *TIMx = PWM_Voices[No].TIMx;
+    // a silent voice has nothing to finish, start the new period right away
+    uint16_t restart = (TIMx->CCR1 == 0);
+
+#ifdef MIDI_STATS
+    // without preload the counter would already be past the new ARR
+    // and run up to 0xFFFF before wrapping
+    if (TIMx->CNT > Autoreload) {
+        PWM_GlitchCount[No] += 1;
+    }
+#endif
+
+    TIMx->CR1 |= TIM_CR1_UDIS;
+    TIMx->PSC = Prescaler;
+    TIMx->ARR = Autoreload;
+    TIMx->CCR1 = Compare;
+    TIMx->CR1 &= (uint16_t)~TIM_CR1_UDIS;
+
+    if (restart) {
+        TIMx->EGR = TIM_EGR_UG;
+    }
+}
 
 #endif
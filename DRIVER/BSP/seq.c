@@ -0,0 +1,372 @@
+#include "stm32f10x.h"                  // Device header
+#include <stdint.h>
+
+#include "pwm.h"
+#include "seq.h"
+#include "dwt.h"
+
+#define SEQ_MASK        (SEQ_STEPS - 1)
+#define SEQ_FIFO_MASK   (SEQ_FIFO_SIZE - 1)
+// longest single step, 65536 ticks repeated 256 times
+#define SEQ_MAX_US      (65536UL * 256)
+
+typedef struct {
+    DMA_Channel_TypeDef *DMAy_Channelx;
+    uint16_t TIM_Channel;
+    uint16_t TIM_DMASource;
+} SEQ_Target;
+
+// each voice timer captures TIM1 TRGO (ITR0) on a spare channel,
+// the capture DMA request of that channel loads the voice
+static const SEQ_Target SEQ_Targets[PWM_VOICE_NUM] = {
+    {DMA1_Channel7, TIM_Channel_2, TIM_DMA_CC2},  // TIM2_CH2
+    {DMA1_Channel2, TIM_Channel_3, TIM_DMA_CC3},  // TIM3_CH3
+};
+
+// The DMA reads slot k at the update event that starts step k+1.
+// TIM1 preloads, so its slot k holds the length of step k+2,
+// the voices take their slot k for step k+1.
+static uint16_t SEQ_ClockRing[SEQ_STEPS][2];                // ARR, RCR
+static uint16_t SEQ_VoiceRing[PWM_VOICE_NUM][SEQ_STEPS][4]; // PSC, ARR, RCR (reserved on TIM2/TIM3), CCR1
+
+static volatile SEQ_Step SEQ_Fifo[SEQ_FIFO_SIZE];
+static volatile uint8_t SEQ_FifoHead = 0;   // moved by the DMA interrupt
+static volatile uint8_t SEQ_FifoTail = 0;   // moved by SEQ_Wait
+
+static SEQ_Step SEQ_State;      // built by SEQ_SetVoice, copied into every pushed step
+static SEQ_Step SEQ_Silence;    // played when the FIFO runs dry
+static uint32_t SEQ_Carry = 0;  // us not covered by the pushed steps yet
+static uint32_t SEQ_Next = 0;   // number of the next step handed to the rings
+static uint8_t SEQ_Running = 0;
+static volatile uint8_t SEQ_Draining = 0;
+static volatile uint8_t SEQ_Halted = 0;
+static volatile uint8_t SEQ_Paused = 0;
+static SEQ_IdleFunc SEQ_OnIdle = 0;
+static uint16_t SEQ_PausedCompare[PWM_VOICE_NUM];
+
+#ifdef MIDI_STATS
+uint32_t SEQ_UnderrunCount = 0;
+uint32_t SEQ_PlayedUs = 0;
+uint32_t SEQ_SleepCycles = 0;
+#endif
+
+static void SEQ_DMAInit(DMA_Channel_TypeDef *DMAy_Channelx, volatile uint16_t *reg, uint16_t *ring, uint16_t size)
+{
+    DMA_InitTypeDef DMA_InitStructure;
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)reg;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)ring;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+    DMA_InitStructure.DMA_BufferSize = size;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init(DMAy_Channelx, &DMA_InitStructure);
+}
+
+static void SEQ_Pop(SEQ_Step *step)
+{
+    uint8_t head = SEQ_FifoHead;
+
+    if (head != SEQ_FifoTail) {
+        *step = SEQ_Fifo[head & SEQ_FIFO_MASK];
+        SEQ_FifoHead = head + 1;
+        return;
+    }
+
+    *step = SEQ_Silence;
+#ifdef MIDI_STATS
+    if (!SEQ_Draining) {
+        SEQ_UnderrunCount += 1;
+    }
+#endif
+}
+
+static void SEQ_Put(const SEQ_Step *step)
+{
+    uint8_t i;
+    uint32_t slot = (SEQ_Next - 1) & SEQ_MASK;
+
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        SEQ_VoiceRing[i][slot][0] = step->Prescaler[i];
+        SEQ_VoiceRing[i][slot][1] = step->Autoreload[i];
+        SEQ_VoiceRing[i][slot][3] = step->Compare[i];
+    }
+
+    slot = (SEQ_Next - 2) & SEQ_MASK;
+    SEQ_ClockRing[slot][0] = step->ClockArr;
+    SEQ_ClockRing[slot][1] = step->ClockRcr;
+
+    SEQ_Next += 1;
+
+#ifdef MIDI_STATS
+    SEQ_PlayedUs += (uint32_t)(step->ClockArr + 1) * (step->ClockRcr + 1);
+#endif
+}
+
+static void SEQ_Refill(uint8_t n)
+{
+    SEQ_Step step;
+    while (n--) {
+        SEQ_Pop(&step);
+        SEQ_Put(&step);
+    }
+}
+
+static void SEQ_Start(void)
+{
+    uint8_t i;
+    SEQ_Step step;
+
+    // step 0 is loaded by hand
+    SEQ_Pop(&step);
+    TIM1->ARR = step.ClockArr;
+    TIM1->RCR = step.ClockRcr;
+    TIM_GenerateEvent(TIM1, TIM_EventSource_Update);
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        PWM_SetVoice(i, step.Prescaler[i], step.Autoreload[i], step.Compare[i]);
+    }
+#ifdef MIDI_STATS
+    SEQ_PlayedUs += (uint32_t)(step.ClockArr + 1) * (step.ClockRcr + 1);
+#endif
+
+    // the length of step 1 goes straight into the TIM1 preload,
+    // its clock slot gets the length of step SEQ_STEPS+1 later on
+    SEQ_Pop(&step);
+    TIM1->ARR = step.ClockArr;
+    TIM1->RCR = step.ClockRcr;
+    SEQ_Next = 1;
+    SEQ_Put(&step);
+    SEQ_Refill(SEQ_STEPS - 1);
+
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        DMA_Cmd(SEQ_Targets[i].DMAy_Channelx, ENABLE);
+        TIM_DMACmd(PWM_Voices[i].TIMx, SEQ_Targets[i].TIM_DMASource, ENABLE);
+    }
+    DMA_Cmd(DMA1_Channel5, ENABLE);
+    TIM_DMACmd(TIM1, TIM_DMA_Update, ENABLE);
+
+    SEQ_Running = 1;
+    TIM_Cmd(TIM1, ENABLE);
+}
+
+static void SEQ_Push(uint16_t ClockArr, uint16_t ClockRcr)
+{
+    // room shows up at the next half transfer interrupt
+    while ((uint8_t)(SEQ_FifoTail - SEQ_FifoHead) == SEQ_FIFO_SIZE) {
+        if (SEQ_Halted) {
+            return;
+        }
+        if (!SEQ_Running && !SEQ_Paused) {
+            SEQ_Start();
+            continue;
+        }
+#ifdef MIDI_STATS
+        uint32_t cycles = DWT_GetCycles();
+        __WFI();
+        SEQ_SleepCycles += DWT_GetCycles() - cycles;
+#else
+        __WFI();
+#endif
+        if (SEQ_OnIdle) {
+            SEQ_OnIdle();
+        }
+    }
+
+    SEQ_State.ClockArr = ClockArr;
+    SEQ_State.ClockRcr = ClockRcr;
+    SEQ_Fifo[SEQ_FifoTail & SEQ_FIFO_MASK] = SEQ_State;
+    SEQ_FifoTail += 1;
+}
+
+void SEQ_Init(SEQ_IdleFunc Func)
+{
+    uint8_t i;
+
+    SEQ_OnIdle = Func;
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM1, ENABLE);
+
+    SEQ_Silence.ClockArr = 999;
+    SEQ_Silence.ClockRcr = 0;
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        SEQ_Silence.Prescaler[i] = SEQ_REST_PSC;
+        SEQ_Silence.Autoreload[i] = SEQ_REST_ARR;
+        SEQ_Silence.Compare[i] = 0;
+    }
+    SEQ_State = SEQ_Silence;
+
+    // step clock, 1us ticks, drives no pin
+    TIM_InternalClockConfig(TIM1);
+
+    TIM_TimeBaseInitTypeDef TIM_TimeBaseInitStructure;
+    TIM_TimeBaseInitStructure.TIM_ClockDivision = TIM_CKD_DIV1;
+    TIM_TimeBaseInitStructure.TIM_CounterMode = TIM_CounterMode_Up;
+    TIM_TimeBaseInitStructure.TIM_Period = 999;     //ARR
+    TIM_TimeBaseInitStructure.TIM_Prescaler = 71;   //PSC
+    TIM_TimeBaseInitStructure.TIM_RepetitionCounter = 0;
+    TIM_TimeBaseInit(TIM1, &TIM_TimeBaseInitStructure);
+
+    TIM_ARRPreloadConfig(TIM1, ENABLE);
+    TIM_UpdateRequestConfig(TIM1, TIM_UpdateSource_Regular);
+    TIM_SelectOutputTrigger(TIM1, TIM_TRGOSource_Update);
+    TIM_DMAConfig(TIM1, TIM_DMABase_ARR, TIM_DMABurstLength_2Transfers);
+    SEQ_DMAInit(DMA1_Channel5, &TIM1->DMAR, &SEQ_ClockRing[0][0], SEQ_STEPS * 2);
+    DMA_ITConfig(DMA1_Channel5, DMA_IT_HT | DMA_IT_TC, ENABLE);
+
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        TIM_TypeDef *TIMx = PWM_Voices[i].TIMx;
+
+        TIM_SelectInputTrigger(TIMx, TIM_TS_ITR0);
+
+        TIM_ICInitTypeDef TIM_ICInitStructure;
+        TIM_ICStructInit(&TIM_ICInitStructure);
+        TIM_ICInitStructure.TIM_Channel = SEQ_Targets[i].TIM_Channel;
+        TIM_ICInitStructure.TIM_ICSelection = TIM_ICSelection_TRC;
+        TIM_ICInit(TIMx, &TIM_ICInitStructure);
+
+        TIM_DMAConfig(TIMx, TIM_DMABase_PSC, TIM_DMABurstLength_4Transfers);
+        SEQ_DMAInit(SEQ_Targets[i].DMAy_Channelx, &TIMx->DMAR, &SEQ_VoiceRing[i][0][0], SEQ_STEPS * 4);
+    }
+
+    // the refill has to beat the DMA, it preempts the serial RX
+    NVIC_InitTypeDef NVIC_InitStructure;
+    NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel5_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_Init(&NVIC_InitStructure);
+
+#ifdef MIDI_STATS
+    DWT_Init();
+#endif
+}
+
+void SEQ_SetVoice(uint8_t No, uint16_t Prescaler, uint16_t Autoreload, uint16_t Compare)
+{
+    if (Compare == 0) {
+        // silent, the next note waits for the end of a rest period only
+        Prescaler = SEQ_REST_PSC;
+        Autoreload = SEQ_REST_ARR;
+    }
+    SEQ_State.Prescaler[No] = Prescaler;
+    SEQ_State.Autoreload[No] = Autoreload;
+    SEQ_State.Compare[No] = Compare;
+}
+
+void SEQ_Wait(uint32_t us)
+{
+    if (SEQ_Halted) {
+        return;
+    }
+    SEQ_Draining = 0;
+
+    us += SEQ_Carry;
+    while (us >= SEQ_MIN_US) {
+        uint32_t chunk = us < SEQ_MAX_US ? us : SEQ_MAX_US;
+        uint32_t periods = (chunk + 0xFFFF) >> 16;
+        uint32_t ticks = chunk / periods;
+        SEQ_Push(ticks - 1, periods - 1);
+        us -= ticks * periods;
+    }
+    SEQ_Carry = us;
+}
+
+void SEQ_Flush(void)
+{
+    SEQ_Draining = 1;
+    if (!SEQ_Running && !SEQ_Halted && !SEQ_Paused) {
+        SEQ_Start();
+    }
+}
+
+static void SEQ_DMAStop(void)
+{
+    uint8_t i;
+
+    TIM_Cmd(TIM1, DISABLE);
+    TIM_DMACmd(TIM1, TIM_DMA_Update, DISABLE);
+    DMA_Cmd(DMA1_Channel5, DISABLE);
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        TIM_DMACmd(PWM_Voices[i].TIMx, SEQ_Targets[i].TIM_DMASource, DISABLE);
+        DMA_Cmd(SEQ_Targets[i].DMAy_Channelx, DISABLE);
+    }
+}
+
+void SEQ_Halt(void)
+{
+    uint8_t i;
+
+    SEQ_Halted = 1;
+    SEQ_DMAStop();
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        PWM_SetCompare1(i, 0);
+    }
+}
+
+void SEQ_Reset(void)
+{
+    uint8_t i;
+
+    SEQ_DMAStop();
+    // a disabled channel starts over from its base address
+    DMA_SetCurrDataCounter(DMA1_Channel5, SEQ_STEPS * 2);
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        DMA_SetCurrDataCounter(SEQ_Targets[i].DMAy_Channelx, SEQ_STEPS * 4);
+    }
+
+    SEQ_FifoHead = 0;
+    SEQ_FifoTail = 0;
+    SEQ_State = SEQ_Silence;
+    SEQ_Carry = 0;
+    SEQ_Running = 0;
+    SEQ_Paused = 0;
+    SEQ_Halted = 0;
+}
+
+void SEQ_Pause(void)
+{
+    uint8_t i;
+
+    if (SEQ_Paused || SEQ_Halted) {
+        return;
+    }
+    SEQ_Paused = 1;
+    // the voices keep the current step until the clock runs again
+    TIM_Cmd(TIM1, DISABLE);
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        SEQ_PausedCompare[i] = PWM_Voices[i].TIMx->CCR1;
+        PWM_SetCompare1(i, 0);
+    }
+}
+
+void SEQ_Resume(void)
+{
+    uint8_t i;
+
+    if (!SEQ_Paused) {
+        return;
+    }
+    SEQ_Paused = 0;
+    for (i = 0; i < PWM_VOICE_NUM; ++i) {
+        PWM_SetCompare1(i, SEQ_PausedCompare[i]);
+    }
+    if (SEQ_Running) {
+        TIM_Cmd(TIM1, ENABLE);
+    }
+}
+
+void DMA1_Channel5_IRQHandler(void)
+{
+    if (DMA_GetITStatus(DMA1_IT_HT5) == SET) {
+        DMA_ClearITPendingBit(DMA1_IT_HT5);
+        SEQ_Refill(SEQ_STEPS / 2);
+    }
+    if (DMA_GetITStatus(DMA1_IT_TC5) == SET) {
+        DMA_ClearITPendingBit(DMA1_IT_TC5);
+        SEQ_Refill(SEQ_STEPS / 2);
+    }
+}
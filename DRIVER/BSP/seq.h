@@ -0,0 +1,62 @@
+#ifndef __SEQ_H
+#define __SEQ_H
+
+#include <stdint.h>
+#include "pwm.h"
+
+// Hardware timed playback, enabled with PWM_DMA_SEQ.
+//
+// TIM1 is the step clock: every update event it DMA-bursts the length of
+// the step after next (ARR, RCR) into itself and raises TRGO. TIM2/TIM3
+// capture that TRGO on a spare channel and DMA-burst their own PSC/ARR/CCR1.
+// Notes are timed by the timers alone, the CPU only refills the rings
+// from the step FIFO in the DMA half/full transfer interrupt.
+//
+// The steps are exact to the 1us tick of TIM1, the voices are not: PSC,
+// ARR and CCR1 are preloaded (see PWM_SetVoice) and nothing generates an
+// update on TIM2/TIM3, so a step's voice change sounds from the voice
+// timer's next update, after the period it plays ends. That is at most
+// one period of the note before it, 1.9ms for C5, the lowest note left
+// by note_fold. A silent voice runs the short SEQ_REST period instead of
+// its last note's, so a note after a rest starts within 10us.
+
+#define SEQ_STEPS       32  // DMA ring length in steps, power of two
+#define SEQ_FIFO_SIZE   32  // power of two
+#define SEQ_MIN_US      20  // shorter steps are merged into the next one
+// period of a silent voice, 10us at the 72MHz timer clock
+#define SEQ_REST_PSC    0
+#define SEQ_REST_ARR    719
+
+typedef struct {
+    uint16_t ClockArr;   // TIM1 ARR, the step clock runs at 1MHz
+    uint16_t ClockRcr;   // TIM1 RCR, step length is (ARR+1)*(RCR+1) us
+    uint16_t Prescaler[PWM_VOICE_NUM];
+    uint16_t Autoreload[PWM_VOICE_NUM];
+    uint16_t Compare[PWM_VOICE_NUM];
+} SEQ_Step;
+
+#ifdef MIDI_STATS
+extern uint32_t SEQ_UnderrunCount;  // steps the DMA needed but the FIFO didn't have
+extern uint32_t SEQ_PlayedUs;       // time handed to the DMA
+extern uint32_t SEQ_SleepCycles;    // cycles spent in WFI waiting for room, seq_load.ini
+#endif
+
+// called after every wake up while SEQ_Wait sleeps, also while paused
+typedef void (*SEQ_IdleFunc)(void);
+
+void SEQ_Init(SEQ_IdleFunc Func);
+// state of a voice for the following steps
+void SEQ_SetVoice(uint8_t No, uint16_t Prescaler, uint16_t Autoreload, uint16_t Compare);
+// hold the current state for us, sleeps while the FIFO is full
+void SEQ_Wait(uint32_t us);
+// no more steps for now, start the DMA even if the FIFO isn't full
+void SEQ_Flush(void);
+// silence right away from an interrupt, steps pushed after are dropped
+void SEQ_Halt(void);
+// after a halt, empty FIFO and rings for the next song
+void SEQ_Reset(void);
+// freeze the step clock muted, and carry on where it stopped
+void SEQ_Pause(void);
+void SEQ_Resume(void);
+
+#endif
@@ -126,14 +126,7 @@ void PendSV_Handler(void)
 {
 }
 
-/**
-  * @brief  This function handles SysTick Handler.
-  * @param  None
-  * @retval None
-  */
-void SysTick_Handler(void)
-{
-}
+/* SysTick_Handler is the time base in USER/delay.c */
 
 /******************************************************************************/
 /*                 STM32F10x Peripherals Interrupt Handlers                   */
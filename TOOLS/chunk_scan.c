@@ -0,0 +1,185 @@
+// Host tool: lists the chunks of MIDI files (RMID too) found by their
+// lengths, and compares decoding the whole file as the device gets it
+// with decoding only MThd and the MTrk chunks, what a sender that skips
+// the metadata chunks transmits. -w writes that stripped file.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/chunk_scan.c USER/midi.c -o chunk_scan
+// usage:
+//   ./chunk_scan [-l] [-r runs] file.mid...     -l: list the chunks
+//   ./chunk_scan -w out.mid file.mid
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "midi.h"
+#include "tool_util.h"
+
+#define MAX_CHUNKS  1024
+
+typedef struct {
+    uint32_t events;
+    uint64_t time_us;
+    uint64_t bytes;
+} result_t;
+
+static void on_event(midi_context_t *ctx, midi_event_t *event)
+{
+    result_t *result = ctx->user_data;
+    result->events += 1;
+    result->time_us += event->delta;
+}
+
+static void feed(midi_context_t *ctx, const uint8_t *data, size_t size, result_t *result)
+{
+    size_t off;
+
+    for (off = 0; off < size && ctx->status != DECODE_COMPLETE; off += BUF_SIZE) {
+        uint16_t len = MIN(BUF_SIZE, size - off);
+        midi_decode(ctx, (uint8_t *)data + off, len);
+        result->bytes += len;
+    }
+}
+
+// the whole file, as the serial link carries it
+static void decode_stream(const uint8_t *data, size_t size, result_t *result)
+{
+    midi_context_t ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    memset(result, 0, sizeof(*result));
+    ctx.on_event = on_event;
+    ctx.user_data = result;
+    feed(&ctx, data, size, result);
+}
+
+static int keep_chunk(const midi_chunk_t *chunk)
+{
+    return chunk->magic == MIDI_HEADER_MAGIC || chunk->magic == MIDI_TRACK_HEADER_MAGIC;
+}
+
+// only MThd and MTrk, located by the chunk directory
+static void decode_chunks(const uint8_t *data, size_t size, const midi_chunk_t *chunks, int count,
+    result_t *result)
+{
+    midi_context_t ctx;
+    int i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    memset(result, 0, sizeof(*result));
+    ctx.on_event = on_event;
+    ctx.user_data = result;
+
+    for (i = 0; i < count && ctx.status != DECODE_COMPLETE; ++i) {
+        if (keep_chunk(&chunks[i])) {
+            size_t end = MIN(size, (size_t)chunks[i].offset + MIDI_CHUNK_HEADER_LEN + chunks[i].len);
+            feed(&ctx, data + chunks[i].offset, end - chunks[i].offset, result);
+        }
+    }
+}
+
+static int write_stripped(const char *path, const uint8_t *data, size_t size, const midi_chunk_t *chunks, int count)
+{
+    FILE *fp = fopen(path, "wb");
+    int i;
+
+    if (fp == NULL) {
+        return -1;
+    }
+    for (i = 0; i < count; ++i) {
+        if (keep_chunk(&chunks[i])) {
+            size_t end = MIN(size, (size_t)chunks[i].offset + MIDI_CHUNK_HEADER_LEN + chunks[i].len);
+            fwrite(data + chunks[i].offset, 1, end - chunks[i].offset, fp);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static midi_chunk_t chunks[MAX_CHUNKS];
+    const char *out = NULL;
+    int list = 0;
+    int runs = 20;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "-l") == 0) {
+            list = 1;
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            out = argv[++i];
+        }
+    }
+
+    if (i >= argc || runs <= 0 || (out && i + 1 != argc)) {
+        fprintf(stderr, "usage: %s [-l] [-r runs] file.mid...\n       %s -w out.mid file.mid\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    for (; i < argc; ++i) {
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+        result_t stream, stripped;
+        double t, us_stream, us_stripped, us_scan;
+        int count, j;
+
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+
+        t = now_us();
+        for (j = 0; j < runs; ++j) {
+            count = midi_scan_chunks(data, size, chunks, MAX_CHUNKS);
+        }
+        us_scan = (now_us() - t) / runs;
+        if (count < 0) {
+            fprintf(stderr, "%s: not a MIDI file\n", argv[i]);
+            free(data);
+            continue;
+        }
+        count = MIN(count, MAX_CHUNKS);
+
+        if (out) {
+            if (write_stripped(out, data, size, chunks, count) != 0) {
+                fprintf(stderr, "%s: can't write\n", out);
+            }
+            free(data);
+            continue;
+        }
+
+        if (list) {
+            for (j = 0; j < count; ++j) {
+                printf("  %.4s at %8u, %8u bytes\n", (const char *)&chunks[j].magic, chunks[j].offset, chunks[j].len);
+            }
+        }
+
+        t = now_us();
+        for (j = 0; j < runs; ++j) {
+            decode_stream(data, size, &stream);
+        }
+        us_stream = (now_us() - t) / runs;
+
+        t = now_us();
+        for (j = 0; j < runs; ++j) {
+            decode_chunks(data, size, chunks, count, &stripped);
+        }
+        us_stripped = (now_us() - t) / runs;
+
+        printf("%s: %d chunks, scanned in %.2f us\n", argv[i], count, us_scan);
+        printf("  whole file:   %8u events %10.3fs %10llu bytes %10.1f us\n", stream.events,
+            stream.time_us / 1e6, (unsigned long long)stream.bytes, us_stream);
+        printf("  MThd + MTrk:  %8u events %10.3fs %10llu bytes %10.1f us%s\n", stripped.events,
+            stripped.time_us / 1e6, (unsigned long long)stripped.bytes, us_stripped,
+            stream.events == stripped.events && stream.time_us == stripped.time_us ? "" : "  MISMATCH");
+
+        free(data);
+    }
+
+    return 0;
+}
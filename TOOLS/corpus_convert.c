@@ -0,0 +1,487 @@
+// Host tool: converts a directory of MIDI files into the song frames the
+// device takes, on a thread pool. Every file is stripped to MThd and its
+// MTrk chunks (midi_scan_chunks), decoded with midi.c to check it and
+// pick the transposition (as transpose.c does), and written as frames:
+// the 5 byte frame header, magic 0xbef2 (a song frame with a transpose),
+// seqid from 0, the transpose byte and the payload size, then up to 32
+// bytes of song data. The sender sends them as they are.
+// out_dir/summary.tsv has a line per file.
+//
+// Every worker has a deque of files, takes from its own end and steals
+// from the other end of another worker's when it runs out, so a few
+// long songs don't leave the other threads idle.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/corpus_convert.c USER/midi.c -o corpus_convert -pthread
+// usage:
+//   ./corpus_convert [-o] [-j threads] in_dir out_dir    writes out_dir/<file>.frm
+//   ./corpus_convert -b [-o] [-j threads] in_dir         scaling from 1 to -j threads, nothing written
+// -o transposes by whole octaves only, as transpose.c -o
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "midi.h"
+#include "note_table.h"
+#include "tool_util.h"
+
+#define FRAME_MAGIC     0xbef2u // MIDI_MAGIC_V2 of main.c
+#define FRAME_HEADER    5       // magic, seqid, transpose, payload size
+#define FRAME_SIZE      32      // song data of a frame
+#define MAX_CHUNKS      4096
+#define MAX_THREADS     256
+
+typedef enum {
+    FILE_OK = 0,
+    FILE_UNREADABLE,
+    FILE_NOT_MIDI,
+    FILE_BROKEN,        // the decoder gave up before the song's end
+    FILE_UNWRITABLE
+} file_status_t;
+
+static const char *g_status_names[] = { "ok", "unreadable", "not midi", "broken", "unwritable" };
+
+typedef struct {
+    char *path;         // relative to the input directory
+    file_status_t status;
+    uint32_t bytes;
+    uint32_t song_bytes; // MThd and MTrk
+    uint32_t frames;
+    uint16_t tracks;
+    uint32_t events;
+    uint32_t notes;
+    uint64_t time_us;
+    int transpose;
+} job_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t *jobs;
+    uint32_t top;       // thieves take here
+    uint32_t bottom;    // the owner takes below here
+} deque_t;
+
+typedef struct worker worker_t;
+
+typedef struct {
+    const char *in_dir;
+    const char *out_dir;    // NULL to convert without writing
+    int octaves;            // transpose by whole octaves only
+    job_t *jobs;
+    uint32_t num_jobs;
+    worker_t *workers;
+    int num_workers;
+} pool_t;
+
+struct worker {
+    pool_t *pool;
+    int id;
+    deque_t deque;
+    pthread_t thread;
+    midi_chunk_t *chunks;
+    uint32_t done;
+    uint32_t stolen;
+};
+
+typedef struct {
+    job_t *job;
+    uint64_t now;
+    uint32_t histogram[128];
+} song_t;
+
+// the directory walk, nftw takes no user data
+static job_t *g_jobs;
+static uint32_t g_num_jobs;
+static uint32_t g_max_jobs;
+static size_t g_root_len;
+
+static int is_midi_name(const char *path)
+{
+    static const char *exts[] = { ".mid", ".midi", ".kar", ".rmi" };
+    size_t len = strlen(path);
+    size_t i;
+
+    for (i = 0; i < sizeof(exts) / sizeof(exts[0]); ++i) {
+        size_t n = strlen(exts[i]);
+        if (len > n && strcasecmp(path + len - n, exts[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int on_path(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    if (type != FTW_F || !is_midi_name(path)) {
+        return 0;
+    }
+    if (g_num_jobs == g_max_jobs) {
+        g_max_jobs = g_max_jobs ? g_max_jobs * 2 : 1024;
+        g_jobs = realloc(g_jobs, g_max_jobs * sizeof(job_t));
+    }
+    memset(&g_jobs[g_num_jobs], 0, sizeof(job_t));
+    g_jobs[g_num_jobs].path = strdup(path + g_root_len + 1);
+    g_num_jobs += 1;
+    return 0;
+}
+
+static int by_path(const void *a, const void *b)
+{
+    return strcmp(((const job_t *)a)->path, ((const job_t *)b)->path);
+}
+
+static void on_event(midi_context_t *ctx, midi_event_t *event)
+{
+    song_t *song = ctx->user_data;
+
+    song->now += event->delta;
+    song->job->events += 1;
+    if (!event->is_meta && (event->status & 0xf0) == NOTE_ON && event->param2 > 0) {
+        song->job->notes += 1;
+    }
+    count_note(song->histogram, event);
+}
+
+// the directories of path below out_dir, others may create them too
+static void make_dirs(char *path, size_t from)
+{
+    char *p;
+
+    for (p = path + from; (p = strchr(p, '/')) != NULL; ++p) {
+        *p = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            *p = '/';
+            return;
+        }
+        *p = '/';
+    }
+}
+
+static int write_frames(const char *out_dir, job_t *job, const uint8_t *song, uint32_t size)
+{
+    size_t len = strlen(out_dir) + strlen(job->path) + 6;
+    char *path = malloc(len);
+    uint8_t frame[FRAME_HEADER + FRAME_SIZE];
+    uint32_t off;
+    FILE *fp;
+
+    snprintf(path, len, "%s/%s.frm", out_dir, job->path);
+    make_dirs(path, strlen(out_dir) + 1);
+    fp = fopen(path, "wb");
+    free(path);
+    if (fp == NULL) {
+        return -1;
+    }
+
+    for (off = 0; off < size; off += FRAME_SIZE) {
+        uint8_t n = MIN(FRAME_SIZE, size - off);
+        frame[0] = FRAME_MAGIC & 0xff;
+        frame[1] = FRAME_MAGIC >> 8;
+        frame[2] = (uint8_t)job->frames;
+        frame[3] = (uint8_t)(int8_t)job->transpose;
+        frame[4] = n;
+        memcpy(&frame[FRAME_HEADER], song + off, n);
+        fwrite(frame, 1, FRAME_HEADER + n, fp);
+        job->frames += 1;
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+static void convert(worker_t *worker, job_t *job)
+{
+    const pool_t *pool = worker->pool;
+    size_t len = strlen(pool->in_dir) + strlen(job->path) + 2;
+    char *path = malloc(len);
+    midi_context_t ctx;
+    song_t song;
+    uint8_t *data, *stripped;
+    size_t size = 0;
+    uint32_t off;
+    int count, i;
+
+    // the benchmark converts every file again
+    memset(&job->status, 0, sizeof(*job) - offsetof(job_t, status));
+    snprintf(path, len, "%s/%s", pool->in_dir, job->path);
+    data = read_file(path, &size);
+    free(path);
+    if (data == NULL) {
+        job->status = FILE_UNREADABLE;
+        return;
+    }
+    job->bytes = size;
+
+    count = midi_scan_chunks(data, size, worker->chunks, MAX_CHUNKS);
+    if (count <= 0 || count > MAX_CHUNKS) {
+        job->status = FILE_NOT_MIDI;
+        free(data);
+        return;
+    }
+
+    // MThd and the MTrk chunks in file order, RIFF and metadata chunks out
+    stripped = malloc(size);
+    for (i = 0; i < count; ++i) {
+        const midi_chunk_t *chunk = &worker->chunks[i];
+        if (chunk->magic == MIDI_HEADER_MAGIC || chunk->magic == MIDI_TRACK_HEADER_MAGIC) {
+            uint32_t end = MIN(size, (size_t)chunk->offset + MIDI_CHUNK_HEADER_LEN + chunk->len);
+            memcpy(stripped + job->song_bytes, data + chunk->offset, end - chunk->offset);
+            job->song_bytes += end - chunk->offset;
+        }
+    }
+    free(data);
+
+    memset(&song, 0, sizeof(song));
+    song.job = job;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.on_event = on_event;
+    ctx.user_data = &song;
+    // the device decodes it in frames too
+    for (off = 0; off < job->song_bytes && ctx.status != DECODE_COMPLETE; off += FRAME_SIZE) {
+        uint16_t n = MIN(FRAME_SIZE, job->song_bytes - off);
+        if (midi_decode(&ctx, stripped + off, n) != MIDI_OK) {
+            break;
+        }
+    }
+    job->tracks = ctx.header.num_tracks;
+    job->time_us = song.now;
+    job->transpose = best_transpose(song.histogram, pool->octaves);
+    job->status = ctx.status == DECODE_COMPLETE ? FILE_OK : FILE_BROKEN;
+
+    if (ctx.header.magic != MIDI_HEADER_MAGIC) {
+        job->status = FILE_NOT_MIDI;
+    } else if (pool->out_dir && write_frames(pool->out_dir, job, stripped, job->song_bytes) != 0) {
+        job->status = FILE_UNWRITABLE;
+    }
+    free(stripped);
+}
+
+static int deque_pop(deque_t *deque, uint32_t *job)
+{
+    int ok;
+
+    pthread_mutex_lock(&deque->lock);
+    ok = deque->bottom > deque->top;
+    if (ok) {
+        *job = deque->jobs[--deque->bottom];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return ok;
+}
+
+static int deque_steal(deque_t *deque, uint32_t *job)
+{
+    int ok;
+
+    pthread_mutex_lock(&deque->lock);
+    ok = deque->bottom > deque->top;
+    if (ok) {
+        *job = deque->jobs[deque->top++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return ok;
+}
+
+// no jobs are added once the workers run, all deques empty is the end
+static void *work(void *arg)
+{
+    worker_t *worker = arg;
+    pool_t *pool = worker->pool;
+    uint32_t job;
+
+    for (;;) {
+        int found = deque_pop(&worker->deque, &job);
+        int i;
+
+        for (i = 1; !found && i < pool->num_workers; ++i) {
+            worker_t *victim = &pool->workers[(worker->id + i) % pool->num_workers];
+            found = deque_steal(&victim->deque, &job);
+            worker->stolen += found;
+        }
+        if (!found) {
+            return NULL;
+        }
+        convert(worker, &pool->jobs[job]);
+        worker->done += 1;
+    }
+}
+
+static double run(pool_t *pool, int threads, uint32_t *stolen)
+{
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    uint32_t per = (pool->num_jobs + threads - 1) / threads;
+    double t;
+    int i;
+
+    pool->workers = workers;
+    pool->num_workers = threads;
+    // contiguous blocks, a directory of long songs lands on one worker
+    // and the others steal from it
+    for (i = 0; i < threads; ++i) {
+        worker_t *worker = &workers[i];
+        uint32_t from = MIN(pool->num_jobs, (uint32_t)i * per);
+        uint32_t to = MIN(pool->num_jobs, from + per);
+        uint32_t j;
+
+        worker->pool = pool;
+        worker->id = i;
+        worker->chunks = malloc(MAX_CHUNKS * sizeof(midi_chunk_t));
+        worker->deque.jobs = malloc((to - from + 1) * sizeof(uint32_t));
+        // the owner pops from the bottom, file order
+        for (j = from; j < to; ++j) {
+            worker->deque.jobs[to - 1 - j] = j;
+        }
+        worker->deque.bottom = to - from;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+    }
+
+    t = now_us();
+    for (i = 1; i < threads; ++i) {
+        pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+    }
+    work(&workers[0]);
+    for (i = 1; i < threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    t = now_us() - t;
+
+    *stolen = 0;
+    for (i = 0; i < threads; ++i) {
+        *stolen += workers[i].stolen;
+        pthread_mutex_destroy(&workers[i].deque.lock);
+        free(workers[i].deque.jobs);
+        free(workers[i].chunks);
+    }
+    free(workers);
+    pool->workers = NULL;
+    return t;
+}
+
+static int write_summary(const pool_t *pool)
+{
+    size_t len = strlen(pool->out_dir) + 16;
+    char *path = malloc(len);
+    uint32_t i;
+    FILE *fp;
+
+    snprintf(path, len, "%s/summary.tsv", pool->out_dir);
+    fp = fopen(path, "w");
+    free(path);
+    if (fp == NULL) {
+        return -1;
+    }
+    fprintf(fp, "file\tstatus\tbytes\tsong_bytes\tframes\ttracks\tevents\tnotes\tseconds\ttranspose\n");
+    for (i = 0; i < pool->num_jobs; ++i) {
+        const job_t *job = &pool->jobs[i];
+        fprintf(fp, "%s\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%.3f\t%d\n", job->path, g_status_names[job->status],
+            job->bytes, job->song_bytes, job->frames, job->tracks, job->events, job->notes,
+            job->time_us / 1e6, job->transpose);
+    }
+    return fclose(fp);
+}
+
+static void print_totals(const pool_t *pool)
+{
+    uint32_t counts[sizeof(g_status_names) / sizeof(g_status_names[0])] = {0};
+    uint64_t bytes = 0, song_bytes = 0;
+    uint32_t i;
+
+    for (i = 0; i < pool->num_jobs; ++i) {
+        counts[pool->jobs[i].status] += 1;
+        bytes += pool->jobs[i].bytes;
+        song_bytes += pool->jobs[i].song_bytes;
+    }
+    printf("%u files, %llu bytes, %llu bytes of song data:", pool->num_jobs, (unsigned long long)bytes,
+        (unsigned long long)song_bytes);
+    for (i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        if (counts[i]) {
+            printf(" %u %s", counts[i], g_status_names[i]);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    pool_t pool;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int bench = 0;
+    int octaves = 0;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "-b") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            octaves = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        }
+    }
+
+    if (threads < 1 || threads > MAX_THREADS || i + (bench ? 1 : 2) != argc) {
+        fprintf(stderr, "usage: %s [-o] [-j threads] in_dir out_dir\n       %s -b [-o] [-j threads] in_dir\n",
+            argv[0], argv[0]);
+        return 1;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    pool.in_dir = argv[i];
+    pool.octaves = octaves;
+    g_root_len = strlen(pool.in_dir);
+    while (g_root_len > 1 && pool.in_dir[g_root_len - 1] == '/') {
+        g_root_len -= 1;
+    }
+    if (nftw(pool.in_dir, on_path, 64, FTW_PHYS) != 0) {
+        fprintf(stderr, "%s: can't walk\n", pool.in_dir);
+        return 1;
+    }
+    // the same files make the same summary
+    qsort(g_jobs, g_num_jobs, sizeof(job_t), by_path);
+    pool.jobs = g_jobs;
+    pool.num_jobs = g_num_jobs;
+
+    if (bench) {
+        double base = 0;
+        int n;
+
+        printf("%8s %10s %10s %8s %8s\n", "threads", "seconds", "files/s", "speedup", "steals");
+        for (n = 1;; n = MIN(n * 2, threads)) {
+            uint32_t stolen;
+            double t = run(&pool, n, &stolen);
+            if (n == 1) {
+                base = t;
+            }
+            printf("%8d %10.3f %10.0f %8.2f %8u\n", n, t / 1e6, pool.num_jobs / (t / 1e6), base / t, stolen);
+            if (n == threads) {
+                break;
+            }
+        }
+        print_totals(&pool);
+        return 0;
+    }
+
+    pool.out_dir = argv[i + 1];
+    if (mkdir(pool.out_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: can't create\n", pool.out_dir);
+        return 1;
+    }
+    uint32_t stolen;
+    double t = run(&pool, threads, &stolen);
+    print_totals(&pool);
+    printf("%d threads, %.3fs, %u steals\n", threads, t / 1e6, stolen);
+    if (write_summary(&pool) != 0) {
+        fprintf(stderr, "%s: can't write summary.tsv\n", pool.out_dir);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Host tool: renders the envelope of a few note patterns tick by tick and
+// checks the shapes, exits with 1 when one of them is off.
+//
+// build (from the repo root):
+//   gcc -O2 -IUSER TOOLS/env_render.c USER/envelope.c -o env_render
+// usage:
+//   ./env_render        check every pattern
+//   ./env_render -p     also print the timelines, "tick stage level" per line
+
+#include <stdio.h>
+#include <string.h>
+
+#include "envelope.h"
+
+#define TICKS 800
+
+typedef struct {
+    const char *name;
+    const env_shape_t *shape;
+    // note on/off ticks, -1 ends the list
+    int on[4];
+    int off[4];
+} pattern_t;
+
+// drum like, no sustain, no release
+static const env_shape_t shape_percussive = {
+    .attack = 0,
+    .decay = 80,
+    .release = 0,
+    .sustain = 0,
+    .attack_curve = ENV_CURVE_LINEAR,
+    .release_curve = ENV_CURVE_EXP,
+};
+
+static const pattern_t patterns[] = {
+    {"long note",           &env_shape_default, {0, -1},        {400, -1}},
+    {"off during attack",   &env_shape_default, {0, -1},        {3, -1}},
+    {"off during decay",    &env_shape_default, {0, -1},        {50, -1}},
+    {"retrigger",           &env_shape_default, {0, 230, -1},   {200, 500, -1}},
+    {"gate",                &env_shape_gate,    {0, -1},        {10, -1}},
+    {"percussive",          &shape_percussive,  {0, 40, -1},    {-1}},
+};
+
+static const char *stage_names[] = {"idle", "attack", "decay", "sustain", "release"};
+
+static int contains(const int *ticks, int tick)
+{
+    for (; *ticks >= 0; ++ticks) {
+        if (*ticks == tick) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint16_t stage_length(const env_shape_t *shape, uint8_t stage)
+{
+    switch (stage) {
+    case ENV_ATTACK:
+        return shape->attack;
+    case ENV_DECAY:
+        return shape->decay;
+    case ENV_RELEASE:
+        return shape->release;
+    default:
+        return TICKS;
+    }
+}
+
+static int check(const pattern_t *p, int print)
+{
+    const env_shape_t *shape = p->shape;
+    envelope_t env;
+    int errors = 0;
+    int length = 0;     // ticks spent in the current stage
+    int tick;
+
+    memset(&env, 0, sizeof(env));
+
+    for (tick = 0; tick < TICKS; ++tick) {
+        uint8_t stage = env.stage;
+        uint8_t level = env.level;
+
+        // starting or releasing must not click unless the stage takes no time
+        if (contains(p->on, tick)) {
+            envelope_start(&env, shape);
+            if (shape->attack != 0 && env.level != level) {
+                printf("%s: tick %d: start jumps %u -> %u\n", p->name, tick, level, env.level);
+                ++errors;
+            }
+            length = 0;
+        }
+        if (contains(p->off, tick)) {
+            level = env.level;
+            envelope_release(&env);
+            if (shape->release != 0 && env.level != level) {
+                printf("%s: tick %d: release jumps %u -> %u\n", p->name, tick, level, env.level);
+                ++errors;
+            }
+            length = 0;
+        }
+
+        stage = env.stage;
+        level = env.level;
+        envelope_tick(&env);
+        ++length;
+        if (print) {
+            printf("%d %s %u\n", tick, stage_names[env.stage], env.level);
+        }
+
+        if (stage == ENV_ATTACK && env.level < level) {
+            printf("%s: tick %d: attack falls %u -> %u\n", p->name, tick, level, env.level);
+            ++errors;
+        }
+        if ((stage == ENV_DECAY || stage == ENV_RELEASE) && env.level > level) {
+            printf("%s: tick %d: %s rises %u -> %u\n", p->name, tick, stage_names[stage], level, env.level);
+            ++errors;
+        }
+        if (stage == ENV_SUSTAIN && env.level != shape->sustain) {
+            printf("%s: tick %d: sustain at %u, not %u\n", p->name, tick, env.level, shape->sustain);
+            ++errors;
+        }
+        if (stage == ENV_IDLE && env.level != 0) {
+            printf("%s: tick %d: idle at %u\n", p->name, tick, env.level);
+            ++errors;
+        }
+
+        if (env.stage != stage) {
+            // every stage ends exactly on its target
+            uint8_t target = stage == ENV_ATTACK ? ENV_LEVEL_MAX : stage == ENV_DECAY ? shape->sustain : 0;
+            if (env.level != target) {
+                printf("%s: tick %d: %s ends at %u, not %u\n", p->name, tick, stage_names[stage], env.level, target);
+                ++errors;
+            }
+            length = 0;
+        } else if (length > stage_length(shape, stage)) {
+            printf("%s: tick %d: %s longer than %u ticks\n", p->name, tick, stage_names[stage],
+                stage_length(shape, stage));
+            ++errors;
+            length = 0;
+        }
+    }
+
+    if (env.stage != ENV_IDLE || env.level != 0) {
+        printf("%s: still %s at %u\n", p->name, stage_names[env.stage], env.level);
+        ++errors;
+    }
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    int print = argc > 1 && strcmp(argv[1], "-p") == 0;
+    int failed = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); ++i) {
+        if (print) {
+            printf("# %s\n", patterns[i].name);
+        }
+        int errors = check(&patterns[i], print);
+        printf("%-20s %s\n", patterns[i].name, errors ? "FAIL" : "ok");
+        failed |= errors != 0;
+    }
+    return failed;
+}
@@ -0,0 +1,184 @@
+// Host tool: decodes MIDI files with and without the decoder's channel
+// and event type masks and compares the callbacks made, the decode time
+// and the time of every event handed out: an event after dropped ones
+// must come at the same song time as without the masks.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/filter_stats.c USER/midi.c -o filter_stats
+// usage:
+//   ./filter_stats [-c channels] [-t types] [-r runs] file.mid...
+//     -c: channels to drop, 1-16 comma separated
+//     -t: event types to drop, hex comma separated, default a0,c0,d0 (the player's)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "midi.h"
+#include "tool_util.h"
+
+typedef struct {
+    uint16_t channel_drop;
+    uint8_t type_drop;
+    uint64_t now;
+    uint32_t events;
+    uint32_t kept;          // events the masks would let through
+    uint64_t *times;        // their song times, without masks
+    uint32_t max_times;
+    uint32_t bad;
+} result_t;
+
+static int dropped(const result_t *result, const midi_event_t *event)
+{
+    return !event->is_meta && (((result->channel_drop >> (event->status & 0x0f))
+        | (result->type_drop >> ((event->status >> 4) & 7))) & 1);
+}
+
+// no masks, the filter applied here after the call
+static void on_event_all(midi_context_t *ctx, midi_event_t *event)
+{
+    result_t *result = ctx->user_data;
+
+    result->now += event->delta;
+    result->events += 1;
+    if (!dropped(result, event) && result->kept < result->max_times) {
+        result->times[result->kept++] = result->now;
+    }
+}
+
+// masks in the decoder, every call is an event kept
+static void on_event_masked(midi_context_t *ctx, midi_event_t *event)
+{
+    result_t *result = ctx->user_data;
+
+    result->now += event->delta;
+    if (result->events >= result->kept || result->times[result->events] != result->now) {
+        result->bad += 1;
+    }
+    result->events += 1;
+}
+
+static void decode(const uint8_t *data, size_t size, result_t *result, int masked)
+{
+    midi_context_t ctx;
+    size_t off;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.on_event = masked ? on_event_masked : on_event_all;
+    ctx.user_data = result;
+    if (masked) {
+        ctx.channel_drop = result->channel_drop;
+        ctx.type_drop = result->type_drop;
+    }
+    result->now = 0;
+    result->events = 0;
+    if (!masked) {
+        result->kept = 0;
+    }
+
+    for (off = 0; off < size && ctx.status != DECODE_COMPLETE; off += BUF_SIZE) {
+        uint16_t len = MIN(BUF_SIZE, size - off);
+        midi_decode(&ctx, (uint8_t *)data + off, len);
+    }
+}
+
+static int parse_list(const char *arg, int base, uint32_t *bits)
+{
+    char *end;
+
+    *bits = 0;
+    for (;;) {
+        long v = strtol(arg, &end, base);
+        if (end == arg) {
+            return -1;
+        }
+        if (base == 10 && v >= 1 && v <= 16) {
+            *bits |= 1u << (v - 1);
+        } else if (base == 16 && v >= NOTE_OFF && v <= PITCHWHEEL && (v & 0x0f) == 0) {
+            *bits |= MIDI_TYPE_BIT(v);
+        } else {
+            return -1;
+        }
+        if (*end != ',') {
+            return *end ? -1 : 0;
+        }
+        arg = end + 1;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t channels = 0;
+    uint32_t types = MIDI_TYPE_BIT(POLYTOUCH) | MIDI_TYPE_BIT(PROGRAM_CHANGE) | MIDI_TYPE_BIT(AFTERTOUCH);
+    int runs = 20;
+    int i = 1;
+
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "-c") == 0) {
+            if (parse_list(argv[i + 1], 10, &channels) != 0) {
+                break;
+            }
+        } else if (strcmp(argv[i], "-t") == 0) {
+            if (parse_list(argv[i + 1], 16, &types) != 0) {
+                break;
+            }
+        } else if (strcmp(argv[i], "-r") == 0) {
+            runs = atoi(argv[i + 1]);
+        }
+    }
+
+    if (i >= argc || argv[i][0] == '-' || runs <= 0) {
+        fprintf(stderr, "usage: %s [-c channels] [-t types] [-r runs] file.mid...\n", argv[0]);
+        return 1;
+    }
+
+    for (; i < argc; ++i) {
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+        result_t result;
+        uint32_t all;
+        uint64_t all_time;
+        double t, us_all, us_masked;
+        int j;
+
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+
+        memset(&result, 0, sizeof(result));
+        result.channel_drop = (uint16_t)channels;
+        result.type_drop = (uint8_t)types;
+        // an event takes at least 2 bytes
+        result.max_times = (uint32_t)(size / 2 + 1);
+        result.times = malloc(result.max_times * sizeof(uint64_t));
+
+        t = now_us();
+        for (j = 0; j < runs; ++j) {
+            decode(data, size, &result, 0);
+        }
+        us_all = (now_us() - t) / runs;
+        all = result.events;
+        all_time = result.kept ? result.times[result.kept - 1] : 0;
+
+        t = now_us();
+        for (j = 0; j < runs; ++j) {
+            result.bad = 0;
+            decode(data, size, &result, 1);
+        }
+        us_masked = (now_us() - t) / runs;
+
+        printf("%s: %u of %u callbacks (%.1f%% fewer), %.3fs to the last one\n", argv[i],
+            result.events, all, all ? 100.0 * (all - result.events) / all : 0.0, all_time / 1e6);
+        // a missing or extra event counts once
+        result.bad += result.events != result.kept;
+        printf("  decode %10.1f us without masks, %10.1f us with, %u mismatched\n",
+            us_all, us_masked, result.bad);
+
+        free(result.times);
+        free(data);
+    }
+
+    return 0;
+}
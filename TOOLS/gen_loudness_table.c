@@ -0,0 +1,88 @@
+// Host tool: generates USER/loudness_table.c, the PWM duty for every
+// velocity and channel gain step, compensating the piezo response.
+//
+// build (from the repo root):
+//   gcc -O2 TOOLS/gen_loudness_table.c -lm -o gen_loudness_table
+// usage:
+//   ./gen_loudness_table > USER/loudness_table.c
+//   ./gen_loudness_table -r     amplitude of the old linear duty vs the table
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../USER/loudness_table.h"
+
+// value of a table step, the last one is the MIDI maximum
+static double step_value(int i)
+{
+    int v = i * LOUDNESS_STEP;
+    return (v > 127 ? 127 : v) / 127.;
+}
+
+// General MIDI: velocity, volume and expression are 40*log10(x) dB each,
+// so the wanted amplitude is the square of their product
+static double target_amplitude(double velocity, double gain)
+{
+    return velocity * velocity * gain * gain;
+}
+
+// the fundamental of a square wave with duty d is proportional to
+// sin(pi * d): it peaks at 50% and fades out again towards 100%
+static double piezo_amplitude(double duty)
+{
+    return sin(M_PI * duty);
+}
+
+static int duty_q8(double velocity, double gain)
+{
+    double duty = asin(target_amplitude(velocity, gain)) / M_PI;
+    int q8 = (int)floor(duty * 256 + 0.5);
+
+    // a note that is played at all stays audible
+    if (q8 == 0 && velocity > 0 && gain > 0) {
+        q8 = 1;
+    }
+    return q8;
+}
+
+static void report(void)
+{
+    int i;
+
+    printf("velocity  wanted    old (linear duty)  table\n");
+    for (i = 1; i < LOUDNESS_STEPS; ++i) {
+        double v = step_value(i);
+        // what onMidiEvent did: duty = velocity / 127 * 100 percent
+        double old = piezo_amplitude(v);
+        double new = piezo_amplitude(duty_q8(v, 1.) / 256.);
+        printf("%8d  %6.3f  %6.3f             %6.3f\n", (int)(v * 127 + 0.5), target_amplitude(v, 1.), old, new);
+    }
+}
+
+static void generate(void)
+{
+    int i, j;
+
+    printf("// generated by TOOLS/gen_loudness_table.c, do not edit\n");
+    printf("\n#include \"loudness_table.h\"\n\n");
+    printf("const uint8_t loudness_duty[LOUDNESS_STEPS][LOUDNESS_STEPS] = {\n");
+    for (i = 0; i < LOUDNESS_STEPS; ++i) {
+        printf("    {");
+        for (j = 0; j < LOUDNESS_STEPS; ++j) {
+            printf("%s%3d", j ? ", " : "", duty_q8(step_value(i), step_value(j)));
+        }
+        printf("},   // velocity %d\n", (int)(step_value(i) * 127 + 0.5));
+    }
+    printf("};\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+        report();
+    } else {
+        generate();
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Host tool: generates USER/note_table.c, the timer prescaler/ARR pair of
+// every MIDI note and the octave fold into the buzzer range, and reports
+// the pitch error.
+//
+// build (from the repo root):
+//   gcc -O2 TOOLS/gen_note_table.c -lm -o gen_note_table
+// usage:
+//   ./gen_note_table > USER/note_table.c
+//   ./gen_note_table -r     worst case cents error, old 1MHz ticks vs the table
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../USER/note_table.h"
+
+#define TIMER_CLOCK 72000000.
+// keep at least 8 bits of duty resolution for the envelopes
+#define MIN_TICKS   256
+
+static double note_freq(int note)
+{
+    return 440. * pow(2., (note - 69) / 12.);
+}
+
+static double cents(double actual, double expect)
+{
+    return 1200. * log2(actual / expect);
+}
+
+// The closest prescaler/autoreload pair. Errors within TOLERANCE of the
+// best one are inaudible, among those the smallest prescaler wins so the
+// ARR, and with it the duty and bend resolution, stays as large as possible.
+#define TOLERANCE   0.05    // cents
+
+static double pair_error(double f, uint32_t p, double *a)
+{
+    *a = floor(TIMER_CLOCK / f / p + 0.5);
+    if (*a > 65536 || *a < MIN_TICKS) {
+        return 1e9;
+    }
+    return fabs(cents(TIMER_CLOCK / (p * *a), f));
+}
+
+static void best_pair(int note, uint32_t *psc, uint32_t *arr)
+{
+    double f = note_freq(note);
+    double best = 1e9;
+    double a;
+    uint32_t p;
+
+    for (p = 1; p <= 65536; ++p) {
+        double err = pair_error(f, p, &a);
+        if (err < best) {
+            best = err;
+        }
+    }
+
+    for (p = 1; p <= 65536; ++p) {
+        if (pair_error(f, p, &a) <= best + TOLERANCE) {
+            *psc = p - 1;
+            *arr = (uint32_t)a - 1;
+            return;
+        }
+    }
+}
+
+// what buzzerPlay did before the table: 1MHz ticks, integer frequency,
+// and the period silently truncated to the 16 bit ARR
+static double old_freq(int note)
+{
+    uint32_t freq = (uint32_t)note_freq(note);
+    uint32_t period = 1000000 / freq;
+    uint16_t arr = (uint16_t)(period - 1);
+    return 1000000. / (arr + 1.);
+}
+
+static void report(void)
+{
+    double worst_old = 0, worst_new = 0;
+    int note_old = 0, note_new = 0;
+    int note;
+
+    for (note = 0; note < 128; ++note) {
+        uint32_t psc = 0, arr = 0;
+        double f = note_freq(note);
+        best_pair(note, &psc, &arr);
+
+        double e_old = cents(old_freq(note), f);
+        double e_new = cents(TIMER_CLOCK / ((psc + 1.) * (arr + 1.)), f);
+        printf("%3d %10.3fHz  old %+9.3f cents  new %+7.4f cents  psc %5u arr %5u\n",
+            note, f, e_old, e_new, psc, arr);
+
+        if (fabs(e_old) > fabs(worst_old)) {
+            worst_old = e_old;
+            note_old = note;
+        }
+        if (fabs(e_new) > fabs(worst_new)) {
+            worst_new = e_new;
+            note_new = note;
+        }
+    }
+
+    printf("worst case old: %+.3f cents (note %d)\n", worst_old, note_old);
+    printf("worst case new: %+.4f cents (note %d)\n", worst_new, note_new);
+}
+
+// octaves towards the buzzer range
+static int fold(int note)
+{
+    while (note < NOTE_RANGE_LOW) {
+        note += 12;
+    }
+    while (note > NOTE_RANGE_HIGH) {
+        note -= 12;
+    }
+    return note;
+}
+
+static void generate(void)
+{
+    int note;
+    int i;
+
+    printf("// generated by TOOLS/gen_note_table.c, do not edit\n");
+    printf("\n#include \"note_table.h\"\n\n");
+    printf("const note_period_t note_periods[128] = {\n");
+    for (note = 0; note < 128; ++note) {
+        uint32_t psc = 0, arr = 0;
+        best_pair(note, &psc, &arr);
+        printf("    {%5u, %5u},   // %3d %.3fHz\n", psc, arr, note, note_freq(note));
+    }
+    printf("};\n");
+
+    printf("\nconst uint8_t note_fold[NOTE_FOLD_SIZE] = {\n");
+    for (i = 0; i < NOTE_FOLD_SIZE; i += 16) {
+        int j;
+        printf("   ");
+        for (j = i; j < i + 16; ++j) {
+            printf(" %3d,", fold(j - NOTE_FOLD_OFFSET));
+        }
+        printf("   // %d..%d\n", i - NOTE_FOLD_OFFSET, i + 15 - NOTE_FOLD_OFFSET);
+    }
+    printf("};\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+        report();
+    } else {
+        generate();
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+// Host tool: plays MIDI files the way the device does with MIDI_LOOP,
+// in song frames up to the "loopStart"/"loopEnd" markers and from the
+// loop buffer after, and checks that every repeat of the region has the
+// events and times of the first pass shifted by the loop length. Notes
+// still on at the end of the first pass are counted, the device cuts
+// them at every wrap.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/loop_stats.c USER/midi.c USER/loop.c -o loop_stats
+// usage:
+//   ./loop_stats [-n wraps] file.mid...     repeats to check, default 100
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi.h"
+#include "loop.h"
+#include "tool_util.h"
+
+#define FRAME_SIZE  32      // song data of a frame
+
+typedef struct {
+    uint64_t time_us;       // sum of the deltas handed out
+    uint8_t status;
+    uint8_t param1;
+    uint8_t param2;
+    uint8_t is_meta;
+} played_event_t;
+
+typedef struct {
+    loop_t loop;
+    played_event_t *events;
+    uint32_t num_events;
+    uint32_t max_events;
+    uint64_t now;
+    uint32_t start_event;   // first event after the start marker
+    uint64_t start_time;
+    uint32_t end_event;     // after the last event of the first pass
+    uint64_t end_time;
+    uint8_t sounding[16][128];  // notes on, per channel
+    uint32_t held;          // notes still on at the end of the first pass
+} player_t;
+
+static void on_event(midi_context_t *ctx, midi_event_t *event)
+{
+    player_t *player = ctx->user_data;
+    uint8_t state = player->loop.state;
+
+    if (!loop_event(&player->loop, ctx, event)) {
+        return;
+    }
+    player->now += event->delta;
+    if (player->num_events < player->max_events) {
+        played_event_t *e = &player->events[player->num_events++];
+        e->time_us = player->now;
+        e->status = event->status;
+        e->param1 = event->param1;
+        e->param2 = event->param2;
+        e->is_meta = event->is_meta;
+    }
+    if (!event->is_meta && (event->status & 0xf0) == NOTE_ON && event->param2 > 0) {
+        player->sounding[event->status & 0x0f][event->param1 & 0x7f] += 1;
+    } else if (!event->is_meta && ((event->status & 0xf0) == NOTE_ON || (event->status & 0xf0) == NOTE_OFF)) {
+        uint8_t *n = &player->sounding[event->status & 0x0f][event->param1 & 0x7f];
+        *n -= *n > 0;
+    }
+
+    if (event->is_meta && (event->status == MARKER || event->status == CUE_MARKER)) {
+        loop_marker(&player->loop, ctx, event);
+        if (state == LOOP_IDLE && player->loop.state == LOOP_RECORDING) {
+            player->start_event = player->num_events;
+            player->start_time = player->now;
+        }
+    }
+}
+
+// song frames until the song ends or the loop takes over, then the loop
+static int play(const uint8_t *data, size_t size, player_t *player, uint32_t wraps)
+{
+    midi_context_t ctx;
+    size_t off;
+    int i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.on_event = on_event;
+    ctx.user_data = player;
+    loop_init(&player->loop);
+
+    for (off = 0; off < size && ctx.status != DECODE_COMPLETE && player->loop.state != LOOP_PLAYING;
+            off += FRAME_SIZE) {
+        uint16_t len = MIN(FRAME_SIZE, size - off);
+        uint32_t offset = ctx.offset;
+        if (midi_decode(&ctx, (uint8_t *)data + off, len) != MIDI_OK) {
+            return -1;
+        }
+        loop_record(&player->loop, &ctx, offset, data + off, len);
+    }
+    // the end marker and the events at its time, the first pass is over
+    player->end_event = player->num_events;
+    player->end_time = player->now;
+    for (i = 0; i < 16 * 128; ++i) {
+        player->held += player->sounding[i / 128][i % 128];
+    }
+
+    while (player->loop.state == LOOP_PLAYING && player->loop.wrap_count < wraps
+            && player->num_events < player->max_events) {
+        if (loop_play(&player->loop, &ctx) != MIDI_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// every event after the first pass against its twin one loop earlier
+static uint32_t check(const player_t *player, uint64_t *worst)
+{
+    uint32_t region = player->end_event - player->start_event;
+    uint64_t length = player->end_time - player->start_time;
+    uint32_t bad = 0;
+    uint32_t i;
+
+    *worst = 0;
+    for (i = player->end_event; i < player->num_events; ++i) {
+        const played_event_t *e = &player->events[i];
+        const played_event_t *twin = &player->events[i - region];
+        uint64_t expect = twin->time_us + length;
+        uint64_t err = e->time_us > expect ? e->time_us - expect : expect - e->time_us;
+
+        if (e->status != twin->status || e->param1 != twin->param1 || e->param2 != twin->param2
+                || e->is_meta != twin->is_meta) {
+            bad += 1;
+        }
+        if (err > *worst) {
+            *worst = err;
+        }
+    }
+    return bad;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t wraps = 100;
+    int i = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        wraps = atoi(argv[2]);
+        i = 3;
+    }
+
+    if (i >= argc || wraps == 0) {
+        fprintf(stderr, "usage: %s [-n wraps] file.mid...\n", argv[0]);
+        return 1;
+    }
+
+    static player_t player;
+    for (; i < argc; ++i) {
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+
+        memset(&player, 0, sizeof(player));
+        // the song once and the region as often as asked, at most
+        player.max_events = (uint32_t)(size / 2 * (wraps + 1));
+        player.events = malloc(player.max_events * sizeof(played_event_t));
+
+        if (play(data, size, &player, wraps) != 0) {
+            fprintf(stderr, "%s: decode failed\n", argv[i]);
+        } else if (player.loop.state == LOOP_OFF) {
+            printf("%s: loop longer than %u bytes or broken, played through\n", argv[i], LOOP_BUFFER);
+        } else if (player.loop.state != LOOP_PLAYING) {
+            printf("%s: no loop markers\n", argv[i]);
+        } else {
+            uint64_t worst = 0;
+            uint32_t bad = check(&player, &worst);
+            printf("%s: region %u bytes, %u events, %.3fs, %u wraps, %u mismatched, worst time error %llu us, "
+                "%u notes held over the wrap\n", argv[i], player.loop.len, player.end_event - player.start_event,
+                (player.end_time - player.start_time) / 1e6, player.loop.wrap_count, bad,
+                (unsigned long long)worst, player.held);
+        }
+
+        free(player.events);
+        free(data);
+    }
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Host tool: prints the lyrics, texts, markers and SysEx of MIDI files
+// from the decoder's on_data slices, counts how the payloads came (a
+// slice of the buffer, put together in the context, or in pieces),
+// checks that decoding in song frames gives the same payloads as
+// decoding from one buffer, and compares the decode time with and
+// without on_data.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/meta_text.c USER/midi.c -o meta_text
+// usage:
+//   ./meta_text [-p] [-r runs] file.mid...     -p: print the payloads
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "midi.h"
+#include "tool_util.h"
+
+#define ONE_BUFFER  65535   // the most midi_decode takes at once
+
+typedef struct {
+    int print;
+    uint32_t payloads;
+    uint32_t whole;         // a slice of the caller's buffer
+    uint32_t staged;        // copied, it spanned buffers
+    uint32_t pieces;        // long and spanning, a slice per buffer
+    uint64_t bytes;
+    uint32_t hash;          // of the types and bytes in order
+} result_t;
+
+static uint32_t fnv(uint32_t hash, const uint8_t *data, uint32_t len)
+{
+    uint32_t i;
+    for (i = 0; i < len; ++i) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void print_slice(midi_context_t *ctx, midi_event_t *event, const midi_slice_t *slice)
+{
+    uint16_t i;
+
+    if (slice->offset == 0) {
+        printf("%10.3f %s 0x%02x %4u ", (ctx->time_us + ctx->pending_us) / 1e6,
+            event->is_meta ? "meta " : "sysex", event->status, slice->total);
+    }
+    for (i = 0; i < slice->len; ++i) {
+        uint8_t c = slice->data[i];
+        if (event->is_meta && c >= 0x20 && c < 0x7f) {
+            putchar(c);
+        } else {
+            printf(event->is_meta ? "\\x%02x" : " %02x", c);
+        }
+    }
+    if (slice->offset + slice->len == slice->total) {
+        putchar('\n');
+    }
+}
+
+static void on_data(midi_context_t *ctx, midi_event_t *event, const midi_slice_t *slice)
+{
+    result_t *result = ctx->user_data;
+    uint8_t status = event->status;
+
+    if (slice->offset == 0) {
+        result->payloads += 1;
+        result->hash = fnv(result->hash, &status, 1);
+        if (slice->data == ctx->tmp.stage) {
+            result->staged += 1;
+        } else if (slice->len == slice->total) {
+            result->whole += 1;
+        } else {
+            result->pieces += 1;
+        }
+    }
+    result->hash = fnv(result->hash, slice->data, slice->len);
+    result->bytes += slice->len;
+
+    if (result->print) {
+        print_slice(ctx, event, slice);
+    }
+}
+
+// without a result the payloads are skipped
+static void decode(const uint8_t *data, size_t size, uint16_t step, result_t *result)
+{
+    midi_context_t ctx;
+    size_t off;
+
+    memset(&ctx, 0, sizeof(ctx));
+    if (result) {
+        int print = result->print;
+        memset(result, 0, sizeof(*result));
+        result->print = print;
+        result->hash = 2166136261u;
+        ctx.on_data = on_data;
+        ctx.user_data = result;
+    }
+
+    for (off = 0; off < size && ctx.status != DECODE_COMPLETE; off += step) {
+        uint16_t len = MIN(step, size - off);
+        midi_decode(&ctx, (uint8_t *)data + off, len);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int print = 0;
+    int runs = 200;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "-p") == 0) {
+            print = 1;
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        }
+    }
+
+    if (i >= argc || runs <= 0) {
+        fprintf(stderr, "usage: %s [-p] [-r runs] file.mid...\n", argv[0]);
+        return 1;
+    }
+
+    for (; i < argc; ++i) {
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+        result_t frames, whole;
+        double t, us_skip, us_data;
+        int j;
+
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+
+        memset(&frames, 0, sizeof(frames));
+        memset(&whole, 0, sizeof(whole));
+        if (print) {
+            printf("%s:\n", argv[i]);
+            frames.print = 1;
+            decode(data, size, BUF_SIZE, &frames);
+            frames.print = 0;
+        }
+
+        // warm up the caches
+        decode(data, size, BUF_SIZE, NULL);
+        t = now_us();
+        for (j = 0; j < runs; ++j) {
+            decode(data, size, BUF_SIZE, NULL);
+        }
+        us_skip = (now_us() - t) / runs;
+
+        t = now_us();
+        for (j = 0; j < runs; ++j) {
+            decode(data, size, BUF_SIZE, &frames);
+        }
+        us_data = (now_us() - t) / runs;
+
+        decode(data, size, ONE_BUFFER, &whole);
+
+        printf("%s: %u payloads, %llu bytes, in %u byte buffers %u whole, %u copied, %u in pieces, %s\n",
+            argv[i], frames.payloads, (unsigned long long)frames.bytes, BUF_SIZE, frames.whole,
+            frames.staged, frames.pieces,
+            frames.payloads == whole.payloads && frames.hash == whole.hash ? "same as one buffer"
+                : "MISMATCH with one buffer");
+        printf("  decode %10.1f us skipping the payloads, %10.1f us with on_data\n", us_skip, us_data);
+
+        free(data);
+    }
+
+    return 0;
+}
@@ -0,0 +1,313 @@
+// Host tool: builds the seek index of a song, a decoder checkpoint every
+// few hundred ms, checks that playing on from every checkpoint gives the
+// same events as playing from the start, and compares the seek latency of
+// both. The sender seeks by sending the checkpoint before the target in a
+// seek frame and the song from the checkpoint's offset on. With -c only
+// the channels of the mask are decoded, those a 0xbeef frame keeps (channel
+// 0 and its channel_id); drums are never among the sounding notes.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/seek_index.c USER/midi.c -o seek_index
+// usage:
+//   ./seek_index [-i ms] [-n seeks] [-c mask] file.mid...
+//   checkpoint spacing, default 500ms; channels kept, default 0xffff
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "midi.h"
+#include "tool_util.h"
+
+#define VERIFY_EVENTS   512     // compared after every checkpoint
+
+typedef struct {
+    uint32_t time_us;
+    uint8_t status;
+    uint8_t param1;
+    uint8_t param2;
+} song_event_t;
+
+// everything a first pass learns about a song
+typedef struct {
+    song_event_t *events;
+    uint32_t num_events;
+    midi_checkpoint_t *index;
+    uint32_t *index_event;      // events before each checkpoint
+    uint32_t num_index;
+    uint32_t time_us;
+    uint16_t channel_drop;
+    // note ons that still sound, the latest last
+    midi_note_t held[128];
+    uint8_t num_held;
+} song_t;
+
+// a decode towards a target time
+typedef struct {
+    uint32_t target;
+    uint32_t events;
+    int reached;
+} seek_t;
+
+static void held_remove(song_t *song, uint8_t channel, uint8_t note)
+{
+    uint8_t i;
+    for (i = 0; i < song->num_held; ++i) {
+        if ((song->held[i].status & 0x0f) == channel && song->held[i].note == note) {
+            memmove(&song->held[i], &song->held[i + 1], (song->num_held - i - 1) * sizeof(midi_note_t));
+            song->num_held -= 1;
+            return;
+        }
+    }
+}
+
+static void on_index_event(midi_context_t *ctx, midi_event_t *event)
+{
+    song_t *song = ctx->user_data;
+    uint8_t type = event->status & 0xf0;
+
+    if (event->is_meta) {
+        return;
+    }
+
+    song_event_t *e = &song->events[song->num_events++];
+    e->time_us = ctx->time_us;
+    e->status = event->status;
+    e->param1 = event->param1;
+    e->param2 = event->param2;
+
+    if (type == NOTE_ON || type == NOTE_OFF) {
+        held_remove(song, event->status & 0x0f, event->param1);
+    }
+    // a drum hit that came back would play again
+    if (type == NOTE_ON && event->param2 > 0 && (event->status & 0x0f) != DRUM_CHANNEL) {
+        if (song->num_held == sizeof(song->held) / sizeof(song->held[0])) {
+            memmove(&song->held[0], &song->held[1], (song->num_held - 1) * sizeof(midi_note_t));
+            song->num_held -= 1;
+        }
+        song->held[song->num_held].status = event->status;
+        song->held[song->num_held].note = event->param1;
+        song->held[song->num_held].velocity = event->param2;
+        song->num_held += 1;
+    }
+}
+
+static void on_seek_event(midi_context_t *ctx, midi_event_t *event)
+{
+    seek_t *seek = ctx->user_data;
+    if (ctx->time_us >= seek->target) {
+        seek->reached = 1;
+    }
+    seek->events += 1;
+}
+
+// a byte at a time, so every event boundary is seen
+static int build_index(const uint8_t *data, size_t size, uint32_t interval_us, song_t *song)
+{
+    midi_context_t ctx;
+    uint32_t next = 0;
+    size_t off;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.on_event = on_index_event;
+    ctx.user_data = song;
+    ctx.channel_drop = song->channel_drop;
+
+    // an event takes at least 2 bytes (a delta and a data byte with
+    // running status), a checkpoint needs an event before it
+    song->events = malloc((size / 2 + 1) * sizeof(song_event_t));
+    song->index = malloc((size / 2 + 1) * sizeof(midi_checkpoint_t));
+    song->index_event = malloc((size / 2 + 1) * sizeof(uint32_t));
+
+    for (off = 0; off < size && ctx.status != DECODE_COMPLETE; ++off) {
+        midi_checkpoint_t *cp = &song->index[song->num_index];
+        if (midi_decode(&ctx, (uint8_t *)data + off, 1) != MIDI_OK) {
+            return -1;
+        }
+        if (ctx.time_us < next || midi_snapshot(&ctx, cp) != MIDI_OK) {
+            continue;
+        }
+
+        // the latest notes are the ones the voices hold too
+        uint8_t n = MIN(song->num_held, MIDI_CHECKPOINT_NOTES);
+        memcpy(cp->notes, &song->held[song->num_held - n], n * sizeof(midi_note_t));
+        song->index_event[song->num_index] = song->num_events;
+        song->num_index += 1;
+        next = ctx.time_us + interval_us;
+    }
+
+    song->time_us = ctx.time_us;
+    return 0;
+}
+
+// the last checkpoint at or before time_us
+static const midi_checkpoint_t *find_checkpoint(const song_t *song, uint32_t time_us, uint32_t *pos)
+{
+    uint32_t lo = 0, hi = song->num_index;
+
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (song->index[mid].time_us <= time_us) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if (pos) {
+        *pos = lo;
+    }
+    return &song->index[lo];
+}
+
+static void verify_event(midi_context_t *ctx, midi_event_t *event)
+{
+    const song_event_t **expect = ctx->user_data;
+
+    if (event->is_meta) {
+        return;
+    }
+    if ((*expect)->time_us != ctx->time_us || (*expect)->status != event->status
+            || (*expect)->param1 != event->param1 || (*expect)->param2 != event->param2) {
+        ctx->user_data = NULL;
+        ctx->on_event = NULL;
+        return;
+    }
+    *expect += 1;
+}
+
+// play on from every checkpoint and compare with the first pass
+static uint32_t verify(const uint8_t *data, size_t size, const song_t *song)
+{
+    uint32_t bad = 0;
+    uint32_t i;
+
+    for (i = 0; i < song->num_index; ++i) {
+        const midi_checkpoint_t *cp = &song->index[i];
+        const song_event_t *expect = &song->events[song->index_event[i]];
+        uint32_t count = MIN(VERIFY_EVENTS, song->num_events - song->index_event[i]);
+        midi_checkpoint_t bare = *cp;
+        midi_context_t ctx;
+        size_t off;
+
+        // the sounding notes are no events of the song
+        memset(bare.notes, 0, sizeof(bare.notes));
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.channel_drop = song->channel_drop;
+        midi_restore(&ctx, &bare);
+        ctx.on_event = verify_event;
+        ctx.user_data = &expect;
+
+        for (off = cp->offset; off < size && ctx.status != DECODE_COMPLETE && ctx.on_event
+                && expect < &song->events[song->index_event[i]] + count; off += BUF_SIZE) {
+            uint16_t len = MIN(BUF_SIZE, size - off);
+            midi_decode(&ctx, (uint8_t *)data + off, len);
+        }
+        if (expect < &song->events[song->index_event[i]] + count) {
+            bad += 1;
+        }
+    }
+    return bad;
+}
+
+// decode from off until an event at or after the target, what a seek
+// costs before the first note can be played
+static size_t seek_decode(midi_context_t *ctx, const uint8_t *data, size_t size, size_t off, seek_t *seek)
+{
+    size_t start = off;
+
+    ctx->on_event = on_seek_event;
+    ctx->user_data = seek;
+    for (; off < size && ctx->status != DECODE_COMPLETE && !seek->reached; off += BUF_SIZE) {
+        uint16_t len = MIN(BUF_SIZE, size - off);
+        midi_decode(ctx, (uint8_t *)data + off, len);
+    }
+    return off - start;
+}
+
+static void bench(const uint8_t *data, size_t size, const song_t *song, int seeks)
+{
+    double bytes_full = 0, bytes_index = 0;
+    double us_full = 0, us_index = 0;
+    int i;
+
+    srand(1);
+    for (i = 0; i < seeks; ++i) {
+        uint32_t target = (uint32_t)((double)rand() / RAND_MAX * song->time_us);
+        midi_context_t ctx;
+        seek_t seek;
+        double t;
+
+        memset(&seek, 0, sizeof(seek));
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.channel_drop = song->channel_drop;
+        seek.target = target;
+        t = now_us();
+        bytes_full += seek_decode(&ctx, data, size, 0, &seek);
+        us_full += now_us() - t;
+
+        memset(&seek, 0, sizeof(seek));
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.channel_drop = song->channel_drop;
+        seek.target = target;
+        t = now_us();
+        const midi_checkpoint_t *cp = find_checkpoint(song, target, NULL);
+        midi_restore(&ctx, cp);
+        bytes_index += seek_decode(&ctx, data, size, cp->offset, &seek);
+        us_index += now_us() - t;
+    }
+
+    printf("  from start:      %10.0f bytes %10.2f us per seek\n", bytes_full / seeks, us_full / seeks);
+    printf("  from checkpoint: %10.0f bytes %10.2f us per seek\n", bytes_index / seeks, us_index / seeks);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t interval_ms = 500;
+    int seeks = 200;
+    uint16_t keep = 0xffff;
+    int i = 1;
+
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "-i") == 0) {
+            interval_ms = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            seeks = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            keep = (uint16_t)strtoul(argv[i + 1], NULL, 0);
+        }
+    }
+
+    if (i >= argc || interval_ms == 0 || seeks <= 0 || keep == 0) {
+        fprintf(stderr, "usage: %s [-i ms] [-n seeks] [-c mask] file.mid...\n", argv[0]);
+        return 1;
+    }
+
+    for (; i < argc; ++i) {
+        song_t song;
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+        memset(&song, 0, sizeof(song));
+        song.channel_drop = ~keep;
+        if (build_index(data, size, interval_ms * 1000, &song) != 0 || song.num_index == 0) {
+            fprintf(stderr, "%s: decode failed\n", argv[i]);
+        } else {
+            printf("%s: %zu bytes, %u events, %.1fs, %u checkpoints (%zu bytes), %u mismatched\n",
+                argv[i], size, song.num_events, song.time_us / 1e6, song.num_index,
+                song.num_index * sizeof(midi_checkpoint_t), verify(data, size, &song));
+            bench(data, size, &song, seeks);
+        }
+
+        free(song.events);
+        free(song.index);
+        free(song.index_event);
+        free(data);
+    }
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+// Host tool: times the decoder with a small player as its consumer, the
+// same source built twice: calling on_event through the pointer, and with
+// the player bound at build time (MIDI_SINK), which link time optimization
+// may inline into the decoder. Compare the ns per event of both builds.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/sink_bench.c USER/midi.c -o sink_bench
+//   gcc -O2 -flto -DNDEBUG -DMIDI_SINK=bench_event -DMIDI_SINK_COMPLETE=bench_complete
+//       -DMIDI_NO_DATA -IUSER TOOLS/sink_bench.c USER/midi.c -o sink_bench_static
+// usage:
+//   ./sink_bench [-r runs] file.mid...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "midi.h"
+#include "tool_util.h"
+
+typedef struct {
+    uint64_t now;
+    uint16_t notes[16][8];  // sounding notes per channel, a bit per note
+    uint8_t controls[16][128];
+    uint32_t events;
+    uint32_t songs;
+    uint32_t sum;           // keeps the work from being optimized out
+} player_t;
+
+// what the device does per event, less the buzzers
+void bench_event(midi_context_t *ctx, midi_event_t *event)
+{
+    player_t *player = ctx->user_data;
+    uint8_t type = event->status & 0xf0;
+    uint8_t channel = event->status & 0x0f;
+
+    player->now += event->delta;
+    player->events += 1;
+    if (event->is_meta) {
+        return;
+    }
+    if (type == NOTE_ON && event->param2 > 0) {
+        player->notes[channel][event->param1 >> 4] |= 1u << (event->param1 & 0x0f);
+        player->sum += event->param1 + event->param2;
+    } else if (type == NOTE_ON || type == NOTE_OFF) {
+        player->notes[channel][event->param1 >> 4] &= ~(1u << (event->param1 & 0x0f));
+    } else if (type == CONTROL_CHANGE) {
+        player->controls[channel][event->param1 & 0x7f] = event->param2;
+    }
+}
+
+void bench_complete(midi_context_t *ctx)
+{
+    player_t *player = ctx->user_data;
+    player->songs += 1;
+}
+
+// the same with either build, the pointers also switch a static sink on
+static void play(const uint8_t *data, size_t size, player_t *player)
+{
+    midi_context_t ctx;
+    size_t off;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.on_event = bench_event;
+    ctx.on_complete = bench_complete;
+    ctx.user_data = player;
+
+    for (off = 0; off < size && ctx.status != DECODE_COMPLETE; off += BUF_SIZE) {
+        uint16_t len = MIN(BUF_SIZE, size - off);
+        midi_decode(&ctx, (uint8_t *)data + off, len);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = 50;
+    int i = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+        runs = atoi(argv[2]);
+        i = 3;
+    }
+
+    if (i >= argc || runs <= 0) {
+        fprintf(stderr, "usage: %s [-r runs] file.mid...\n", argv[0]);
+        return 1;
+    }
+
+#ifdef MIDI_SINK
+    printf("static sink\n");
+#else
+    printf("on_event pointer\n");
+#endif
+
+    static player_t player;
+    for (; i < argc; ++i) {
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+        double t, best = 0;
+        int j;
+
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+
+        // the fastest run, the others met a busy machine
+        for (j = 0; j < runs; ++j) {
+            memset(&player, 0, sizeof(player));
+            t = now_us();
+            play(data, size, &player);
+            t = now_us() - t;
+            if (j == 0 || t < best) {
+                best = t;
+            }
+        }
+
+        printf("%s: %u events, %u songs, %.3fs, %8.1f us, %5.2f ns per event (sum %u)\n", argv[i],
+            player.events, player.songs, player.now / 1e6, best,
+            player.events ? best * 1e3 / player.events : 0.0, player.sum);
+
+        free(data);
+    }
+
+    return 0;
+}
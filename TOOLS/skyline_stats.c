@@ -0,0 +1,545 @@
+// Host tool: reduces MIDI files to a single melodic line and reports how
+// many notes of the melody survive, for one buzzer voice stealing as it
+// goes, the streaming skyline of the device and an offline skyline that
+// sees the whole song.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/skyline_stats.c USER/midi.c USER/voice.c USER/skyline.c -o skyline_stats
+// usage:
+//   ./skyline_stats [-m channel] file.mid...    melody channel 1..16, default guessed
+//   ./skyline_stats -w out.mid file.mid         also write the offline line and the drums
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi.h"
+#include "voice.h"
+#include "skyline.h"
+#include "tool_util.h"
+
+// a melody note counts as kept when the line plays its pitch for at
+// least this part of its length
+#define KEEP_PERCENT    50
+
+typedef struct {
+    uint32_t on;
+    uint32_t off;
+    uint8_t channel;
+    uint8_t note;
+    uint8_t velocity;
+} note_t;
+
+typedef struct {
+    note_t *notes;
+    size_t count;
+    size_t size;
+} note_list_t;
+
+typedef struct {
+    uint32_t time;
+    midi_event_t event;
+} timed_event_t;
+
+typedef struct {
+    timed_event_t *events;
+    size_t count;
+    size_t size;
+    uint32_t now;
+} event_list_t;
+
+typedef struct {
+    note_list_t *line;
+    uint32_t now;
+    long open;          // index of the sounding line note, -1 for none
+} line_builder_t;
+
+static void *grow(void *ptr, size_t *size, size_t count, size_t item)
+{
+    if (count < *size) {
+        return ptr;
+    }
+    *size = *size ? *size * 2 : 256;
+    ptr = realloc(ptr, *size * item);
+    if (ptr == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static note_t *note_add(note_list_t *list, uint32_t on, uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    list->notes = grow(list->notes, &list->size, list->count, sizeof(note_t));
+    note_t *n = &list->notes[list->count++];
+    n->on = on;
+    n->off = on;
+    n->channel = channel;
+    n->note = note;
+    n->velocity = velocity;
+    return n;
+}
+
+static void on_event(midi_context_t *ctx, midi_event_t *event)
+{
+    event_list_t *list = ctx->user_data;
+
+    list->now += event->delta;
+    list->events = grow(list->events, &list->size, list->count, sizeof(timed_event_t));
+    list->events[list->count].time = list->now;
+    list->events[list->count].event = *event;
+    list->count += 1;
+}
+
+// decode the way the device does, in serial payload sized chunks
+static int decode(const uint8_t *data, size_t size, event_list_t *list)
+{
+    midi_context_t ctx;
+    size_t off;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.on_event = on_event;
+    ctx.user_data = list;
+
+    for (off = 0; off < size && ctx.status != DECODE_COMPLETE; off += BUF_SIZE) {
+        uint16_t len = MIN(BUF_SIZE, size - off);
+        if (midi_decode(&ctx, (uint8_t *)data + off, len) != MIDI_OK) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int is_note_on(const midi_event_t *event)
+{
+    return !event->is_meta && (event->status & 0xf0) == NOTE_ON && event->param2 > 0;
+}
+
+static int is_note_off(const midi_event_t *event)
+{
+    uint8_t type = event->status & 0xf0;
+    return !event->is_meta && (type == NOTE_OFF || (type == NOTE_ON && event->param2 == 0));
+}
+
+// pairs note ons and offs, a retrigger of a sounding note ends it
+static void collect_notes(const event_list_t *events, note_list_t *notes, int with_drums)
+{
+    static long open[16][128];
+    size_t i;
+
+    memset(open, 0xff, sizeof(open));
+    for (i = 0; i < events->count; ++i) {
+        const timed_event_t *te = &events->events[i];
+        uint8_t channel = te->event.status & 0x0f;
+        uint8_t note = te->event.param1 & 0x7f;
+
+        if (!with_drums && channel == DRUM_CHANNEL) {
+            continue;
+        }
+        if (is_note_on(&te->event) || is_note_off(&te->event)) {
+            if (open[channel][note] >= 0) {
+                notes->notes[open[channel][note]].off = te->time;
+                open[channel][note] = -1;
+            }
+        }
+        if (is_note_on(&te->event)) {
+            note_add(notes, te->time, channel, note, te->event.param2);
+            open[channel][note] = notes->count - 1;
+        }
+    }
+
+    // whatever is still held ends with the song
+    uint32_t end = events->count ? events->events[events->count - 1].time : 0;
+    for (i = 0; i < notes->count; ++i) {
+        if (notes->notes[i].off == notes->notes[i].on && open[notes->notes[i].channel][notes->notes[i].note] == (long)i) {
+            notes->notes[i].off = end;
+        }
+    }
+}
+
+// the channel with the highest mean pitch among the ones that carry
+// a fair share of the notes
+static int guess_melody(const note_list_t *notes)
+{
+    uint32_t count[16] = {0};
+    uint64_t sum[16] = {0};
+    int best = -1;
+    size_t i;
+
+    for (i = 0; i < notes->count; ++i) {
+        count[notes->notes[i].channel] += 1;
+        sum[notes->notes[i].channel] += notes->notes[i].note;
+    }
+    for (i = 0; i < 16; ++i) {
+        if (count[i] * 10 < notes->count) {
+            continue;
+        }
+        if (best < 0 || sum[i] * count[best] > sum[best] * count[i]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void line_start(line_builder_t *lb, uint32_t time, uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    if (lb->open >= 0) {
+        lb->line->notes[lb->open].off = time;
+    }
+    note_add(lb->line, time, channel, note, velocity);
+    lb->open = lb->line->count - 1;
+}
+
+static void line_stop(line_builder_t *lb, uint32_t time, uint8_t channel, uint8_t note)
+{
+    if (lb->open >= 0 && lb->line->notes[lb->open].channel == channel && lb->line->notes[lb->open].note == note) {
+        lb->line->notes[lb->open].off = time;
+        lb->open = -1;
+    }
+}
+
+// what one buzzer plays today: every note on takes the voice
+static void reduce_one_voice(const event_list_t *events, note_list_t *line)
+{
+    line_builder_t lb = {line, 0, -1};
+    voice_allocator_t va;
+    size_t i;
+
+    voice_init(&va, 1, VOICE_STEAL_LRU);
+    for (i = 0; i < events->count; ++i) {
+        const timed_event_t *te = &events->events[i];
+        uint8_t channel = te->event.status & 0x0f;
+
+        if (channel == DRUM_CHANNEL) {
+            continue;
+        }
+        if (is_note_on(&te->event)) {
+            if (voice_note_on(&va, channel, te->event.param1, te->event.param2) != VOICE_NONE) {
+                line_start(&lb, te->time, channel, te->event.param1, te->event.param2);
+            }
+        } else if (is_note_off(&te->event)) {
+            if (voice_note_off(&va, channel, te->event.param1) != VOICE_NONE) {
+                line_stop(&lb, te->time, channel, te->event.param1);
+            }
+        }
+    }
+}
+
+static void on_skyline(void *user, midi_event_t *event)
+{
+    line_builder_t *lb = user;
+    uint8_t channel = event->status & 0x0f;
+
+    lb->now += event->delta;
+    if (channel == DRUM_CHANNEL) {
+        return;
+    }
+    if (is_note_on(event)) {
+        line_start(lb, lb->now, channel, event->param1, event->param2);
+    } else if (is_note_off(event)) {
+        line_stop(lb, lb->now, channel, event->param1);
+    }
+}
+
+// the device stage, fed the decoded deltas
+static void reduce_stream(const event_list_t *events, note_list_t *line)
+{
+    line_builder_t lb = {line, 0, -1};
+    skyline_t sk;
+    size_t i;
+
+    skyline_init(&sk, on_skyline, &lb);
+    for (i = 0; i < events->count; ++i) {
+        skyline_push(&sk, &events->events[i].event);
+    }
+    skyline_flush(&sk);
+}
+
+typedef struct {
+    uint32_t time;
+    long note;      // index, negative for an off as ~index
+} edge_t;
+
+static int edge_cmp(const void *a, const void *b)
+{
+    const edge_t *x = a, *y = b;
+    if (x->time != y->time) {
+        return x->time < y->time ? -1 : 1;
+    }
+    // offs first, a note ending where the next starts doesn't overlap
+    return (x->note >= 0) - (y->note >= 0);
+}
+
+static int note_cmp(const void *a, const void *b)
+{
+    const note_t *x = a, *y = b;
+    if (x->on != y->on) {
+        return x->on < y->on ? -1 : 1;
+    }
+    return y->note - x->note;
+}
+
+// with the whole song at hand: every stretch of time goes to the highest
+// sounding note, a note that owns at least half of its length is kept
+// and plays until the next kept note
+static void reduce_offline(const note_list_t *notes, note_list_t *line)
+{
+    edge_t *edges = malloc(notes->count * 2 * sizeof(edge_t) + 1);
+    uint32_t *owned = calloc(notes->count + 1, sizeof(uint32_t));
+    uint32_t count[128] = {0};
+    long latest[128];
+    size_t i, n = 0;
+
+    for (i = 0; i < notes->count; ++i) {
+        edges[n].time = notes->notes[i].on;
+        edges[n++].note = i;
+        edges[n].time = notes->notes[i].off;
+        edges[n++].note = ~(long)i;
+    }
+    qsort(edges, n, sizeof(edge_t), edge_cmp);
+
+    memset(latest, 0xff, sizeof(latest));
+    for (i = 0; i < n; ++i) {
+        if (i > 0 && edges[i].time > edges[i - 1].time) {
+            int p;
+            for (p = 127; p >= 0 && count[p] == 0; --p) {
+            }
+            if (p >= 0) {
+                owned[latest[p]] += edges[i].time - edges[i - 1].time;
+            }
+        }
+        if (edges[i].note >= 0) {
+            uint8_t p = notes->notes[edges[i].note].note;
+            count[p] += 1;
+            latest[p] = edges[i].note;
+        } else {
+            count[notes->notes[~edges[i].note].note] -= 1;
+        }
+    }
+
+    for (i = 0; i < notes->count; ++i) {
+        const note_t *src = &notes->notes[i];
+        if (src->off > src->on && (uint64_t)owned[i] * 100 >= (uint64_t)(src->off - src->on) * KEEP_PERCENT) {
+            note_add(line, src->on, src->channel, src->note, src->velocity)->off = src->off;
+        }
+    }
+    qsort(line->notes, line->count, sizeof(note_t), note_cmp);
+    for (i = 0; i + 1 < line->count; ++i) {
+        if (line->notes[i].off > line->notes[i + 1].on) {
+            line->notes[i].off = line->notes[i + 1].on;
+        }
+    }
+    // two kept notes with the same onset, the lower one is gone
+    n = 0;
+    for (i = 0; i < line->count; ++i) {
+        if (line->notes[i].off > line->notes[i].on) {
+            line->notes[n++] = line->notes[i];
+        }
+    }
+    line->count = n;
+
+    free(edges);
+    free(owned);
+}
+
+// line notes are monophonic and sorted, find the ones overlapping the
+// melody note with its pitch
+static int is_kept(const note_list_t *line, const note_t *m)
+{
+    size_t lo = 0, hi = line->count;
+    uint32_t covered = 0;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (line->notes[mid].off <= m->on) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; lo < line->count && line->notes[lo].on < m->off; ++lo) {
+        const note_t *l = &line->notes[lo];
+        if (l->note == m->note) {
+            covered += (l->off < m->off ? l->off : m->off) - (l->on > m->on ? l->on : m->on);
+        }
+    }
+    return (uint64_t)covered * 100 >= (uint64_t)(m->off - m->on) * KEEP_PERCENT;
+}
+
+static void report(const char *file, const char *method, const note_list_t *notes, const note_list_t *line, int melody)
+{
+    uint32_t total = 0, kept = 0, foreign = 0;
+    size_t i;
+
+    for (i = 0; i < notes->count; ++i) {
+        const note_t *m = &notes->notes[i];
+        if (m->channel == melody && m->off > m->on) {
+            total += 1;
+            kept += is_kept(line, m);
+        }
+    }
+    for (i = 0; i < line->count; ++i) {
+        foreign += line->notes[i].channel != melody;
+    }
+
+    printf("%-32s %-10s %4d %8u %8u %7.2f%% %8zu %7.2f%%\n", file, method, melody + 1, total, kept,
+        total ? 100. * kept / total : 0., line->count, line->count ? 100. * foreign / line->count : 0.);
+}
+
+static void put_vlq(FILE *fp, uint32_t value)
+{
+    uint8_t bytes[5];
+    int n = 0;
+
+    do {
+        bytes[n++] = value & 0x7f;
+        value >>= 7;
+    } while (value);
+    while (n--) {
+        fputc(bytes[n] | (n ? 0x80 : 0), fp);
+    }
+}
+
+static void put_be(FILE *fp, uint32_t value, int bytes)
+{
+    while (bytes--) {
+        fputc((value >> (bytes * 8)) & 0xff, fp);
+    }
+}
+
+static int edge_note_cmp(const void *a, const void *b)
+{
+    const timed_event_t *x = a, *y = b;
+    if (x->time != y->time) {
+        return x->time < y->time ? -1 : 1;
+    }
+    return is_note_on(&x->event) - is_note_on(&y->event);
+}
+
+// format 0 at one tick per millisecond, the line plus the drums
+static int write_line(const char *path, const note_list_t *line, const note_list_t *all)
+{
+    timed_event_t *events = malloc((line->count + all->count) * 2 * sizeof(timed_event_t) + 1);
+    size_t i, n = 0;
+    long start;
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL || events == NULL) {
+        return -1;
+    }
+    for (i = 0; i < line->count + all->count; ++i) {
+        const note_t *src = i < line->count ? &line->notes[i] : &all->notes[i - line->count];
+        if (i >= line->count && src->channel != DRUM_CHANNEL) {
+            continue;
+        }
+        events[n].time = src->on / 1000;
+        events[n].event = (midi_event_t){0, NOTE_ON | src->channel, src->note, src->velocity, 0};
+        n++;
+        events[n].time = src->off / 1000;
+        events[n].event = (midi_event_t){0, NOTE_OFF | src->channel, src->note, 0, 0};
+        n++;
+    }
+    qsort(events, n, sizeof(timed_event_t), edge_note_cmp);
+
+    fwrite("MThd", 1, 4, fp);
+    put_be(fp, 6, 4);
+    put_be(fp, 0, 2);
+    put_be(fp, 1, 2);
+    put_be(fp, 1000, 2);
+    fwrite("MTrk", 1, 4, fp);
+    start = ftell(fp);
+    put_be(fp, 0, 4);
+
+    // a second per quarter: a tick is a millisecond
+    put_vlq(fp, 0);
+    fwrite("\xff\x51\x03\x0f\x42\x40", 1, 6, fp);
+    uint32_t last = 0;
+    for (i = 0; i < n; ++i) {
+        put_vlq(fp, events[i].time - last);
+        last = events[i].time;
+        fputc(events[i].event.status, fp);
+        fputc(events[i].event.param1, fp);
+        fputc(events[i].event.param2, fp);
+    }
+    put_vlq(fp, 0);
+    fwrite("\xff\x2f\x00", 1, 3, fp);
+
+    long end = ftell(fp);
+    fseek(fp, start, SEEK_SET);
+    put_be(fp, end - start - 4, 4);
+    fclose(fp);
+    free(events);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i = 1;
+    int melody_arg = -1;
+    const char *out = NULL;
+
+    while (i + 1 < argc && argv[i][0] == '-') {
+        if (strcmp(argv[i], "-m") == 0) {
+            melody_arg = atoi(argv[i + 1]) - 1;
+        } else if (strcmp(argv[i], "-w") == 0) {
+            out = argv[i + 1];
+        } else {
+            break;
+        }
+        i += 2;
+    }
+
+    if (i >= argc) {
+        fprintf(stderr, "usage: %s [-m channel] [-w out.mid] file.mid...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-32s %-10s %4s %8s %8s %8s %8s %8s\n", "file", "method", "ch", "melody", "kept", "kept%", "line", "foreign%");
+
+    for (; i < argc; ++i) {
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+        event_list_t events = {0};
+        note_list_t notes = {0}, all = {0};
+        note_list_t lines[3] = {{0}};
+
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+        if (decode(data, size, &events) != 0) {
+            fprintf(stderr, "%s: decode failed\n", argv[i]);
+            free(data);
+            continue;
+        }
+
+        collect_notes(&events, &notes, 0);
+        int melody = melody_arg >= 0 ? melody_arg : guess_melody(&notes);
+
+        reduce_one_voice(&events, &lines[0]);
+        reduce_stream(&events, &lines[1]);
+        reduce_offline(&notes, &lines[2]);
+        report(argv[i], "one-voice", &notes, &lines[0], melody);
+        report(argv[i], "stream", &notes, &lines[1], melody);
+        report(argv[i], "offline", &notes, &lines[2], melody);
+
+        if (out != NULL) {
+            collect_notes(&events, &all, 1);
+            if (write_line(out, &lines[2], &all) != 0) {
+                fprintf(stderr, "%s: can't write\n", out);
+            }
+            out = NULL;
+        }
+
+        for (int j = 0; j < 3; ++j) {
+            free(lines[j].notes);
+        }
+        free(all.notes);
+        free(notes.notes);
+        free(events.events);
+        free(data);
+    }
+
+    return 0;
+}
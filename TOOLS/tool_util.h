@@ -0,0 +1,95 @@
+#ifndef __TOOL_UTIL_H
+#define __TOOL_UTIL_H
+
+// What the host tools share: reading a file, a clock for the benchmarks
+// and the transposition of transpose.c. Header only, the build lines of
+// the tools stay as they are.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "midi.h"
+#include "note_table.h"
+
+#define DRUM_CHANNEL    9
+
+// the whole file, NULL when it can't be read
+static inline uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    uint8_t *data = malloc(len > 0 ? len : 1);
+    if (data != NULL && fread(data, 1, len, fp) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+
+    *size = len;
+    return data;
+}
+
+static inline double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// the melodic note ons of a song by note, what the transposition counts
+static inline void count_note(uint32_t *histogram, const midi_event_t *event)
+{
+    if (!event->is_meta && (event->status & 0xf0) == NOTE_ON && event->param2 > 0
+            && (event->status & 0x0f) != DRUM_CHANNEL) {
+        histogram[event->param1 & 0x7f] += 1;
+    }
+}
+
+static inline uint32_t in_range(const uint32_t *histogram, int transpose)
+{
+    uint32_t count = 0;
+    int note;
+
+    for (note = 0; note < 128; ++note) {
+        int key = note + transpose;
+        if (key >= NOTE_RANGE_LOW && key <= NOTE_RANGE_HIGH) {
+            count += histogram[note];
+        }
+    }
+    return count;
+}
+
+// the most notes in range, ties go to the smallest shift; whole octaves
+// only keep the key
+static inline int best_transpose(const uint32_t *histogram, int octaves)
+{
+    int step = octaves ? 12 : 1;
+    int best = 0;
+    uint32_t best_count = in_range(histogram, 0);
+    int t;
+
+    for (t = step; t <= NOTE_TRANSPOSE_MAX; t += step) {
+        uint32_t up = in_range(histogram, t);
+        uint32_t down = in_range(histogram, -t);
+        if (up > best_count) {
+            best = t;
+            best_count = up;
+        }
+        if (down > best_count) {
+            best = -t;
+            best_count = down;
+        }
+    }
+    return best;
+}
+
+#endif
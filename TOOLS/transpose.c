@@ -0,0 +1,91 @@
+// Host tool: picks the transposition of every song that puts the most
+// notes into the buzzer range, the sender writes it into the transpose
+// byte of the frame header. The device folds what is still outside by
+// octaves.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/transpose.c USER/midi.c -o transpose
+// usage:
+//   ./transpose [-o] file.mid...    -o: whole octaves only, keeps the key
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi.h"
+#include "note_table.h"
+#include "tool_util.h"
+
+static void on_event(midi_context_t *ctx, midi_event_t *event)
+{
+    count_note(ctx->user_data, event);
+}
+
+static int decode(const uint8_t *data, size_t size, uint32_t *histogram)
+{
+    midi_context_t ctx;
+    size_t off;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.on_event = on_event;
+    ctx.user_data = histogram;
+
+    for (off = 0; off < size && ctx.status != DECODE_COMPLETE; off += BUF_SIZE) {
+        uint16_t len = MIN(BUF_SIZE, size - off);
+        if (midi_decode(&ctx, (uint8_t *)data + off, len) != MIDI_OK) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i = 1;
+    int octaves = 0;
+
+    if (argc > 1 && strcmp(argv[1], "-o") == 0) {
+        octaves = 1;
+        i = 2;
+    }
+
+    if (i >= argc) {
+        fprintf(stderr, "usage: %s [-o] file.mid...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-32s %9s %8s %8s %8s %8s\n", "file", "transpose", "notes", "as-is%", "moved%", "folded%");
+
+    for (; i < argc; ++i) {
+        uint32_t histogram[128] = {0};
+        uint32_t total = 0;
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+        int note;
+
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+        if (decode(data, size, histogram) != 0) {
+            fprintf(stderr, "%s: decode failed\n", argv[i]);
+            free(data);
+            continue;
+        }
+        for (note = 0; note < 128; ++note) {
+            total += histogram[note];
+        }
+
+        int transpose = best_transpose(histogram, octaves);
+        uint32_t moved = in_range(histogram, transpose);
+        printf("%-32s %+9d %8u %7.2f%% %7.2f%% %7.2f%%\n", argv[i], transpose, total,
+            total ? 100. * in_range(histogram, 0) / total : 0.,
+            total ? 100. * moved / total : 0.,
+            total ? 100. * (total - moved) / total : 0.);
+
+        free(data);
+    }
+
+    return 0;
+}
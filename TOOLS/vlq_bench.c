@@ -0,0 +1,174 @@
+// Host tool: times the two VLQ readers of vlq.h, the byte loop the
+// device uses and the word at a time one of the host builds, on the
+// delta times of MIDI files: the deltas between the events of every
+// track are written again as VLQs and read back in 32 byte buffers, as
+// the decoder gets them, and from one buffer.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/vlq_bench.c USER/midi.c -o vlq_bench
+// usage:
+//   ./vlq_bench [-r runs] file.mid...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "midi.h"
+#include "vlq.h"
+#include "tool_util.h"
+
+typedef int (*vlq_reader_t)(const uint8_t *buf, uint16_t *len, uint32_t *value);
+
+typedef struct {
+    uint8_t *data;          // the deltas as VLQs
+    size_t size;
+    size_t max_size;
+    uint32_t count;
+    uint64_t sum;
+    uint32_t lengths[5];    // numbers of 1 to 4 bytes, [0] unused
+    uint32_t last_tick;
+} stream_t;
+
+static void put_vlq(stream_t *stream, uint32_t value)
+{
+    uint8_t bytes[5];
+    int n = 0;
+
+    do {
+        bytes[n++] = value & 0x7f;
+        value >>= 7;
+    } while (value);
+
+    if (stream->size + n > stream->max_size) {
+        return;
+    }
+    stream->lengths[MIN(n, 4)] += 1;
+    while (n--) {
+        stream->data[stream->size++] = bytes[n] | (n ? 0x80 : 0);
+    }
+}
+
+static void on_event(midi_context_t *ctx, midi_event_t *event)
+{
+    stream_t *stream = ctx->user_data;
+
+    // a new track starts at tick 0
+    if (ctx->tick < stream->last_tick) {
+        stream->last_tick = 0;
+    }
+    put_vlq(stream, ctx->tick - stream->last_tick);
+    stream->count += 1;
+    stream->sum += ctx->tick - stream->last_tick;
+    stream->last_tick = ctx->tick;
+}
+
+// all numbers of the stream in buffers of step bytes
+static uint64_t read_all(vlq_reader_t reader, const uint8_t *data, size_t size, uint16_t step, uint32_t *count)
+{
+    uint64_t sum = 0;
+    uint32_t value = 0;
+    size_t off;
+
+    *count = 0;
+    for (off = 0; off < size; off += step) {
+        uint16_t left = MIN(step, size - off);
+        const uint8_t *p = data + off;
+
+        while (left > 0) {
+            uint16_t len = left;
+            int ret = reader(p, &len, &value);
+            p += len;
+            left -= len;
+            if (ret == MIDI_OK) {
+                sum += value;
+                value = 0;
+                *count += 1;
+            }
+        }
+    }
+    return sum;
+}
+
+// the fastest of runs, ns per number
+static double bench(vlq_reader_t reader, const stream_t *stream, uint16_t step, int runs, int *ok)
+{
+    double best = 0;
+    int j;
+
+    *ok = 1;
+    for (j = 0; j < runs; ++j) {
+        uint32_t count;
+        double t = now_us();
+        uint64_t sum = read_all(reader, stream->data, stream->size, step, &count);
+        t = now_us() - t;
+        if (sum != stream->sum || count != stream->count) {
+            *ok = 0;
+        }
+        if (j == 0 || t < best) {
+            best = t;
+        }
+    }
+    return stream->count ? best * 1e3 / stream->count : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = 200;
+    int i = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+        runs = atoi(argv[2]);
+        i = 3;
+    }
+
+    if (i >= argc || runs <= 0) {
+        fprintf(stderr, "usage: %s [-r runs] file.mid...\n", argv[0]);
+        return 1;
+    }
+
+    for (; i < argc; ++i) {
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+        midi_context_t ctx;
+        stream_t stream;
+        size_t off;
+        int ok[4];
+        double ns[4];
+
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+
+        memset(&stream, 0, sizeof(stream));
+        // a delta takes at least one byte of the file
+        stream.max_size = size * 4 + 4;
+        stream.data = malloc(stream.max_size);
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.on_event = on_event;
+        ctx.user_data = &stream;
+        for (off = 0; off < size && ctx.status != DECODE_COMPLETE; off += BUF_SIZE) {
+            uint16_t len = MIN(BUF_SIZE, size - off);
+            midi_decode(&ctx, data + off, len);
+        }
+
+        ns[0] = bench(vlq_read_bytes, &stream, BUF_SIZE, runs, &ok[0]);
+        ns[1] = bench(vlq_read_word, &stream, BUF_SIZE, runs, &ok[1]);
+        ns[2] = bench(vlq_read_bytes, &stream, 65535, runs, &ok[2]);
+        ns[3] = bench(vlq_read_word, &stream, 65535, runs, &ok[3]);
+
+        double pct = stream.count ? 100.0 / stream.count : 0.0;
+        printf("%s: %u deltas, %.1f%% 1 byte, %.1f%% 2, %.1f%% 3, %.1f%% 4\n", argv[i], stream.count,
+            stream.lengths[1] * pct, stream.lengths[2] * pct, stream.lengths[3] * pct, stream.lengths[4] * pct);
+        printf("  %u byte buffers: %5.2f ns byte loop, %5.2f ns word%s\n", BUF_SIZE, ns[0], ns[1],
+            ok[0] && ok[1] ? "" : "  MISMATCH");
+        printf("  one buffer:      %5.2f ns byte loop, %5.2f ns word%s\n", ns[2], ns[3],
+            ok[2] && ok[3] ? "" : "  MISMATCH");
+
+        free(stream.data);
+        free(data);
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+// Host tool: replays MIDI files through the voice allocator and reports
+// how many notes every steal policy drops.
+//
+// build (from the repo root):
+//   gcc -O2 -DNDEBUG -IUSER TOOLS/voice_stats.c USER/midi.c USER/voice.c -o voice_stats
+// usage:
+//   ./voice_stats [-n voices] file.mid...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi.h"
+#include "voice.h"
+#include "tool_util.h"
+
+static const char *policy_names[VOICE_STEAL_POLICY_NUM] = {
+    "lru",
+    "lowest-velocity",
+    "highest-note",
+};
+
+static void on_event(midi_context_t *ctx, midi_event_t *event)
+{
+    voice_allocator_t *va = ctx->user_data;
+    uint8_t channel = event->status & 0x0f;
+    uint8_t type = event->status & 0xf0;
+
+    if (type == NOTE_ON && event->param2 > 0) {
+        voice_note_on(va, channel, event->param1, event->param2);
+    } else if (type == NOTE_ON || type == NOTE_OFF) {
+        voice_note_off(va, channel, event->param1);
+    }
+}
+
+// feed the file the way the device receives it, in serial payload sized chunks
+static int replay(const uint8_t *data, size_t size, voice_allocator_t *va)
+{
+    midi_context_t ctx;
+    size_t off;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.on_event = on_event;
+    ctx.user_data = va;
+
+    for (off = 0; off < size && ctx.status != DECODE_COMPLETE; off += BUF_SIZE) {
+        uint16_t len = MIN(BUF_SIZE, size - off);
+        if (midi_decode(&ctx, (uint8_t *)data + off, len) != MIDI_OK) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i = 1;
+    int num_voices = 3;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        num_voices = atoi(argv[2]);
+        i = 3;
+    }
+
+    if (i >= argc) {
+        fprintf(stderr, "usage: %s [-n voices] file.mid...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-32s %-16s %8s %8s %8s %7s\n", "file", "policy", "notes", "stolen", "dropped", "lost%");
+
+    for (; i < argc; ++i) {
+        size_t size = 0;
+        uint8_t *data = read_file(argv[i], &size);
+        if (data == NULL) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            continue;
+        }
+
+        for (int p = 0; p < VOICE_STEAL_POLICY_NUM; ++p) {
+            voice_allocator_t va;
+            voice_init(&va, num_voices, p);
+            if (replay(data, size, &va) != 0) {
+                fprintf(stderr, "%s: decode failed\n", argv[i]);
+                break;
+            }
+
+            uint32_t lost = va.stolen_count + va.dropped_count;
+            printf("%-32s %-16s %8u %8u %8u %6.2f%%\n", argv[i], policy_names[p],
+                va.note_on_count, va.stolen_count, va.dropped_count,
+                va.note_on_count ? 100. * lost / va.note_on_count : 0.);
+        }
+
+        free(data);
+    }
+
+    return 0;
+}
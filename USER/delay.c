@@ -1,18 +1,41 @@
 #include "stm32f10x.h"
 #include "delay.h"
 
+#define DELAY_TICK_US   1000    // SysTick period, also the control rate
+
+static volatile uint32_t gDelayMs = 0;
+static OnTickFunc gOnTickCb = 0;
+
 /**
-  * @brief  微秒级延时
-  * @param  xus 延时时长，范围：0~233015
+  * @brief  启动SysTick，每1ms中断一次，作为时基和控制速率定时器
+  * @param  func 每次中断时调用，可以为0
   * @retval 无
   */
-static inline void _delay_us(uint32_t xus)
+void delay_init(OnTickFunc func)
 {
-    SysTick->LOAD = 72 * xus;				//设置定时器重装值
+    gOnTickCb = func;
+    SysTick->LOAD = 72 * DELAY_TICK_US - 1;		//设置定时器重装值
     SysTick->VAL = 0x00;					//清空当前计数值
-    SysTick->CTRL = 0x00000005;				//设置时钟源为HCLK，启动定时器
-    while(!(SysTick->CTRL & 0x00010000));	//等待计数到0
-    SysTick->CTRL = 0x00000004;				//关闭定时器
+    NVIC_SetPriority(SysTick_IRQn, 0x0f);	//最低优先级，串口和DMA可以抢占
+    SysTick->CTRL = 0x00000007;				//时钟源为HCLK，开中断，启动定时器
+}
+
+/**
+  * @brief  当前时间
+  * @param  无
+  * @retval 启动后的微秒数，约71分钟回绕一次
+  */
+uint32_t delay_now_us(void)
+{
+    uint32_t ms, val;
+
+    // the ms count and the counter must belong to the same tick
+    do {
+        ms = gDelayMs;
+        val = SysTick->VAL;
+    } while (ms != gDelayMs);
+
+    return ms * DELAY_TICK_US + (72 * DELAY_TICK_US - 1 - val) / 72;
 }
 
 /**
@@ -24,20 +47,19 @@ void delay_ms(uint32_t xms)
 {
     while(xms--)
     {
-        _delay_us(1000);
+        delay_us(1000);
     }
 }
 
+/**
+  * @brief  微秒级延时
+  * @param  us 延时时长，范围：0~2147483647
+  * @retval 无
+  */
 void delay_us(uint32_t us)
 {
-    if (us == 0) {
-        return;
-    }
-    if (us < 233015) {
-        _delay_us(us);
-    } else {
-        delay_ms(us/1000);
-    }
+    uint32_t deadline = delay_now_us() + us;
+    while ((int32_t)(delay_now_us() - deadline) < 0);
 }
 
 /**
@@ -52,3 +74,11 @@ void delay_s(uint32_t xs)
         delay_ms(1000);
     }
 }
+
+void SysTick_Handler(void)
+{
+    gDelayMs += 1;
+    if (gOnTickCb) {
+        gOnTickCb();
+    }
+}
@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 
+typedef void (*OnTickFunc)(void);
+
+void delay_init(OnTickFunc func);
+uint32_t delay_now_us(void);
 void delay_us(uint32_t us);
 void delay_ms(uint32_t ms);
 void delay_s(uint32_t s);
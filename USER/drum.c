@@ -0,0 +1,96 @@
+#include <stddef.h>
+
+#include "drum.h"
+
+#define DRUM(kind, from, to, decay) \
+    {kind, from, to, {0, decay, 0, 0, ENV_CURVE_LINEAR, ENV_CURVE_EXP}}
+
+enum {
+    KICK = 0,
+    SNARE,
+    CLAP,
+    HAT_CLOSED,
+    HAT_OPEN,
+    CRASH,
+    RIDE,
+    TOM_LOW,
+    TOM_MID,
+    TOM_HIGH,
+    CLICK,
+    NONE = 0xff
+};
+
+// decays in 1ms control ticks, a piezo has nothing below ~C3 so the
+// kick is a fast downward chirp rather than a low thump
+static const drum_pattern_t drum_patterns[] = {
+    [KICK]          = DRUM(DRUM_CHIRP, 60, 36, 80),
+    [SNARE]         = DRUM(DRUM_NOISE, 96, 96, 120),
+    [CLAP]          = DRUM(DRUM_NOISE, 100, 100, 60),
+    [HAT_CLOSED]    = DRUM(DRUM_NOISE, 115, 115, 30),
+    [HAT_OPEN]      = DRUM(DRUM_NOISE, 115, 115, 200),
+    [CRASH]         = DRUM(DRUM_NOISE, 110, 110, 400),
+    [RIDE]          = DRUM(DRUM_NOISE, 118, 118, 250),
+    [TOM_LOW]       = DRUM(DRUM_CHIRP, 64, 55, 150),
+    [TOM_MID]       = DRUM(DRUM_CHIRP, 70, 61, 130),
+    [TOM_HIGH]      = DRUM(DRUM_CHIRP, 76, 67, 110),
+    [CLICK]         = DRUM(DRUM_CHIRP, 96, 90, 20),
+};
+
+// GM key -> pattern, from DRUM_FIRST
+static const uint8_t drum_keys[DRUM_LAST - DRUM_FIRST + 1] = {
+    KICK,       // 35 acoustic bass drum
+    KICK,       // 36 bass drum 1
+    CLICK,      // 37 side stick
+    SNARE,      // 38 acoustic snare
+    CLAP,       // 39 hand clap
+    SNARE,      // 40 electric snare
+    TOM_LOW,    // 41 low floor tom
+    HAT_CLOSED, // 42 closed hi-hat
+    TOM_LOW,    // 43 high floor tom
+    HAT_CLOSED, // 44 pedal hi-hat
+    TOM_MID,    // 45 low tom
+    HAT_OPEN,   // 46 open hi-hat
+    TOM_MID,    // 47 low-mid tom
+    TOM_HIGH,   // 48 hi-mid tom
+    CRASH,      // 49 crash cymbal 1
+    TOM_HIGH,   // 50 high tom
+    RIDE,       // 51 ride cymbal 1
+    CRASH,      // 52 chinese cymbal
+    RIDE,       // 53 ride bell
+    HAT_CLOSED, // 54 tambourine
+    CRASH,      // 55 splash cymbal
+    CLICK,      // 56 cowbell
+    CRASH,      // 57 crash cymbal 2
+    CLAP,       // 58 vibraslap
+    RIDE,       // 59 ride cymbal 2
+    TOM_HIGH,   // 60 hi bongo
+    TOM_MID,    // 61 low bongo
+    TOM_HIGH,   // 62 mute hi conga
+    TOM_HIGH,   // 63 open hi conga
+    TOM_MID,    // 64 low conga
+    TOM_HIGH,   // 65 high timbale
+    TOM_MID,    // 66 low timbale
+    CLICK,      // 67 high agogo
+    CLICK,      // 68 low agogo
+    HAT_CLOSED, // 69 cabasa
+    HAT_CLOSED, // 70 maracas
+    NONE,       // 71 short whistle
+    NONE,       // 72 long whistle
+    CLAP,       // 73 short guiro
+    CLAP,       // 74 long guiro
+    CLICK,      // 75 claves
+    CLICK,      // 76 hi wood block
+    CLICK,      // 77 low wood block
+    TOM_HIGH,   // 78 mute cuica
+    TOM_MID,    // 79 open cuica
+    CLICK,      // 80 mute triangle
+    CLICK,      // 81 open triangle
+};
+
+const drum_pattern_t *drum_pattern(uint8_t note)
+{
+    if (note < DRUM_FIRST || note > DRUM_LAST || drum_keys[note - DRUM_FIRST] == NONE) {
+        return NULL;
+    }
+    return &drum_patterns[drum_keys[note - DRUM_FIRST]];
+}
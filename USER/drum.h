@@ -0,0 +1,27 @@
+#ifndef __DRUM_H
+#define __DRUM_H
+
+#include <stdint.h>
+
+#include "envelope.h"
+
+#define DRUM_CHANNEL    9       // MIDI channel 10
+#define DRUM_FIRST      35      // GM percussion key map
+#define DRUM_LAST       81
+
+typedef enum {
+    DRUM_CHIRP = 0,     // tone sweeping from one note to the other with the level
+    DRUM_NOISE,         // random periods around the note
+} drum_kind_t;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t from;       // note at full level
+    uint8_t to;         // note at level 0, same as from for noise
+    env_shape_t shape;  // no sustain, the burst ends by itself
+} drum_pattern_t;
+
+// NULL for the keys that have no pattern
+const drum_pattern_t *drum_pattern(uint8_t note);
+
+#endif
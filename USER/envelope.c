@@ -0,0 +1,124 @@
+#include "envelope.h"
+
+// progress 0..255 at 64 points of the stage, the last entry is the end
+const uint8_t env_curves[ENV_CURVE_NUM][(1 << ENV_CURVE_BITS) + 1] = {
+    // ENV_CURVE_LINEAR
+    {
+          0,   4,   8,  12,  16,  20,  24,  28,  32,  36,  40,  44,  48,
+         52,  56,  60,  64,  68,  72,  76,  80,  84,  88,  92,  96, 100,
+        104, 108, 112, 116, 120, 124, 128, 131, 135, 139, 143, 147, 151,
+        155, 159, 163, 167, 171, 175, 179, 183, 187, 191, 195, 199, 203,
+        207, 211, 215, 219, 223, 227, 231, 235, 239, 243, 247, 251, 255
+    },
+    // ENV_CURVE_EXP, (1 - e^(-4x)) / (1 - e^-4)
+    {
+          0,  16,  31,  44,  57,  70,  81,  92, 102, 112, 121, 129, 137,
+        144, 151, 158, 164, 170, 175, 181, 185, 190, 194, 198, 202, 205,
+        209, 212, 215, 217, 220, 222, 225, 227, 229, 231, 232, 234, 236,
+        237, 238, 240, 241, 242, 243, 244, 245, 246, 247, 248, 248, 249,
+        250, 250, 251, 251, 252, 252, 253, 253, 254, 254, 254, 255, 255
+    },
+};
+
+// 1ms control ticks
+const env_shape_t env_shape_default = {
+    .attack = 5,
+    .decay = 150,
+    .release = 60,
+    .sustain = 160,
+    .attack_curve = ENV_CURVE_LINEAR,
+    .release_curve = ENV_CURVE_EXP,
+};
+
+const env_shape_t env_shape_gate = {
+    .attack = 0,
+    .decay = 0,
+    .release = 0,
+    .sustain = ENV_LEVEL_MAX,
+    .attack_curve = ENV_CURVE_LINEAR,
+    .release_curve = ENV_CURVE_LINEAR,
+};
+
+static void envelope_enter(envelope_t *env, uint8_t stage);
+
+static void envelope_stage(envelope_t *env, uint8_t stage, uint16_t ticks, uint8_t to)
+{
+    env->stage = stage;
+    env->from = env->level;
+    env->to = to;
+    env->phase = 0;
+
+    if (ticks == 0) {
+        env->level = to;
+        envelope_enter(env, stage == ENV_RELEASE ? ENV_IDLE : stage + 1);
+        return;
+    }
+    // rounded up, the stage never takes longer than asked
+    env->step = (ENV_PHASE_END + ticks - 1) / ticks;
+}
+
+static void envelope_enter(envelope_t *env, uint8_t stage)
+{
+    const env_shape_t *shape = env->shape;
+
+    switch (stage) {
+    case ENV_ATTACK:
+        envelope_stage(env, stage, shape->attack, ENV_LEVEL_MAX);
+        break;
+    case ENV_DECAY:
+        envelope_stage(env, stage, shape->decay, shape->sustain);
+        break;
+    case ENV_RELEASE:
+        envelope_stage(env, stage, shape->release, 0);
+        break;
+    case ENV_SUSTAIN:
+        // nothing to hold, percussive shapes end after the decay
+        env->stage = shape->sustain ? ENV_SUSTAIN : ENV_IDLE;
+        break;
+    default:
+        env->stage = stage;
+        break;
+    }
+}
+
+void envelope_start(envelope_t *env, const env_shape_t *shape)
+{
+    env->shape = shape;
+    envelope_enter(env, ENV_ATTACK);
+}
+
+void envelope_release(envelope_t *env)
+{
+    if (env->stage != ENV_IDLE && env->stage != ENV_RELEASE) {
+        envelope_enter(env, ENV_RELEASE);
+    }
+}
+
+void envelope_reset(envelope_t *env)
+{
+    env->stage = ENV_IDLE;
+    env->level = 0;
+}
+
+uint8_t envelope_tick(envelope_t *env)
+{
+    if (!envelope_moving(env)) {
+        return env->level;
+    }
+
+    env->phase += env->step;
+    if (env->phase >= ENV_PHASE_END) {
+        env->level = env->to;
+        envelope_enter(env, env->stage == ENV_RELEASE ? ENV_IDLE : env->stage + 1);
+        return env->level;
+    }
+
+    // interpolate between two points of the curve
+    const uint8_t *curve = env_curves[env->stage == ENV_ATTACK ? env->shape->attack_curve : env->shape->release_curve];
+    uint32_t i = env->phase >> (16 - ENV_CURVE_BITS);
+    uint32_t frac = env->phase & ((1u << (16 - ENV_CURVE_BITS)) - 1);
+    int32_t progress = curve[i] + (((curve[i + 1] - curve[i]) * (int32_t)frac) >> (16 - ENV_CURVE_BITS));
+
+    env->level = env->from + (((int32_t)env->to - env->from) * progress) / 255;
+    return env->level;
+}
@@ -0,0 +1,65 @@
+#ifndef __ENVELOPE_H
+#define __ENVELOPE_H
+
+#include <stdint.h>
+
+#define ENV_LEVEL_MAX   255
+#define ENV_PHASE_END   65536u  // a stage is over when its phase reaches this
+#define ENV_CURVE_BITS  6       // the curves have 2^6 segments
+
+typedef enum {
+    ENV_IDLE = 0,
+    ENV_ATTACK,
+    ENV_DECAY,
+    ENV_SUSTAIN,
+    ENV_RELEASE
+} env_stage_t;
+
+typedef enum {
+    ENV_CURVE_LINEAR = 0,
+    ENV_CURVE_EXP,          // fast then slow, like an RC, for decay and release
+    ENV_CURVE_NUM
+} env_curve_t;
+
+// stage lengths are in control ticks, a length of 0 jumps to the target
+typedef struct {
+    uint16_t attack;
+    uint16_t decay;
+    uint16_t release;
+    uint8_t sustain;        // level, 0..ENV_LEVEL_MAX, 0 ends the note after the decay
+    uint8_t attack_curve;
+    uint8_t release_curve;  // decay and release
+} env_shape_t;
+
+typedef struct {
+    const env_shape_t *shape;
+    uint32_t phase;         // progress in the stage, 0..ENV_PHASE_END
+    uint32_t step;          // phase increment per tick
+    uint8_t stage;
+    uint8_t level;          // current output, 0..ENV_LEVEL_MAX
+    uint8_t from;           // level at the start of the stage
+    uint8_t to;             // level at the end of the stage
+} envelope_t;
+
+// normalized progress of every curve, shared by all the voices
+extern const uint8_t env_curves[ENV_CURVE_NUM][(1 << ENV_CURVE_BITS) + 1];
+
+extern const env_shape_t env_shape_default;
+// the plain rectangle: full level on start, silent on release
+extern const env_shape_t env_shape_gate;
+
+// (re)start from the current level, a retriggered voice doesn't click
+void envelope_start(envelope_t *env, const env_shape_t *shape);
+void envelope_release(envelope_t *env);
+// silence right away
+void envelope_reset(envelope_t *env);
+// advance one control tick, returns the new level
+uint8_t envelope_tick(envelope_t *env);
+
+// the level changes on the next ticks
+static inline int envelope_moving(const envelope_t *env)
+{
+    return env->stage != ENV_IDLE && env->stage != ENV_SUSTAIN;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#include <string.h>
+
+#include "loop.h"
+
+void loop_init(loop_t *loop)
+{
+    memset(loop, 0, sizeof(*loop));
+}
+
+void loop_marker(loop_t *loop, midi_context_t *ctx, const midi_event_t *event)
+{
+    if (event->param1 & MIDI_LOOP_START) {
+        if (loop->state == LOOP_IDLE) {
+            // handed out between two events, the snapshot can't fail
+            loop->state = midi_snapshot(ctx, &loop->start) == MIDI_OK ? LOOP_RECORDING : LOOP_OFF;
+        }
+        return;
+    }
+
+    if (!(event->param1 & MIDI_LOOP_END)) {
+        return;
+    }
+
+    if (loop->state == LOOP_RECORDING) {
+        if (ctx->offset - loop->start.offset > LOOP_BUFFER) {
+            loop->state = LOOP_OFF;
+            return;
+        }
+        loop->state = LOOP_CLOSING;
+        loop->on_event = ctx->on_event;
+        loop->on_complete = ctx->on_complete;
+    }
+
+    if (loop->state == LOOP_CLOSING || loop->state == LOOP_PLAYING) {
+        // the song ending at the end marker's time ends the region too
+        ctx->on_complete = NULL;
+        loop->closing = 1;
+    }
+}
+
+// the region ends before the first event with a delta after the end marker
+static void loop_close(loop_t *loop, midi_context_t *ctx)
+{
+    ctx->on_event = NULL;
+    ctx->on_complete = NULL;
+    loop->closing = 0;
+    loop->wrap = 1;
+    if (loop->state == LOOP_CLOSING) {
+        // the rest of the buffer being decoded is kept, the repeats stop
+        // at the same event
+        loop->state = LOOP_PLAYING;
+        loop->end = UINT32_MAX;
+    }
+}
+
+// too long or broken, the song plays through and ends as it would have
+static void loop_off(loop_t *loop, midi_context_t *ctx)
+{
+    if (loop->closing) {
+        ctx->on_complete = loop->on_complete;
+        loop->closing = 0;
+    }
+    loop->state = LOOP_OFF;
+}
+
+int loop_event(loop_t *loop, midi_context_t *ctx, const midi_event_t *event)
+{
+    if (!loop->closing || event->delta == 0) {
+        return 1;
+    }
+    // after the loop, unheard, its delta isn't waited
+    loop_close(loop, ctx);
+    return 0;
+}
+
+void loop_record(loop_t *loop, midi_context_t *ctx, uint32_t offset, const uint8_t *buf, uint16_t len)
+{
+    uint32_t from = loop->start.offset;
+    uint32_t to = offset + len;
+
+    if (loop->state == LOOP_IDLE || loop->state == LOOP_OFF) {
+        return;
+    }
+    if (loop->state == LOOP_PLAYING) {
+        // the buffer that ended the region, nothing after it
+        to = MIN(to, MIN(loop->end, loop->start.offset + LOOP_BUFFER));
+        loop->end = to;
+    }
+    from = from + loop->len;
+    if (from < offset) {
+        // a piece of the region went by unseen
+        loop_off(loop, ctx);
+        return;
+    }
+    if (to - loop->start.offset > LOOP_BUFFER) {
+        loop_off(loop, ctx);
+        return;
+    }
+    if (to > from) {
+        memcpy(&loop->buf[loop->len], buf + (from - offset), to - from);
+        loop->len += to - from;
+    }
+
+    if (loop->state == LOOP_CLOSING && ctx->status == DECODE_COMPLETE) {
+        // no event after the end marker, the song's end closes the region
+        loop_close(loop, ctx);
+    }
+}
+
+int loop_play(loop_t *loop, midi_context_t *ctx)
+{
+    uint16_t len;
+
+    if (loop->wrap) {
+        // the end marker's delta was waited already, the first event of
+        // the region follows with its own, as after the start marker
+        midi_restore(ctx, &loop->start);
+        ctx->on_event = loop->on_event;
+        ctx->on_complete = loop->on_complete;
+        loop->pos = 0;
+        loop->wrap = 0;
+        loop->wrap_count += 1;
+    }
+
+    len = MIN(BUF_SIZE, loop->len - loop->pos);
+    if (len == 0 && loop->closing) {
+        // the song ended at the end marker's time
+        loop_close(loop, ctx);
+        return MIDI_OK;
+    }
+    if (len == 0) {
+        // nothing between the markers, or bytes missing
+        loop_off(loop, ctx);
+        return MIDI_ABORT;
+    }
+    loop->pos += len;
+    if (midi_decode(ctx, &loop->buf[loop->pos - len], len) != MIDI_OK) {
+        loop_off(loop, ctx);
+        return MIDI_ABORT;
+    }
+    return MIDI_OK;
+}
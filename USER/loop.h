@@ -0,0 +1,52 @@
+#ifndef __LOOP_H
+#define __LOOP_H
+
+#include <stdint.h>
+
+#include "midi.h"
+
+// Loop points from "loopStart"/"loopEnd" markers: the decoder state at
+// the start is kept as a checkpoint and the song data up to the end
+// marker as it streams by. Events at the end marker's time still play
+// (the note offs that close the region), the first event after it
+// starts the region over: it is decoded again and again from RAM, the
+// rest of the song is dropped, until the player is reset. A region
+// longer than the buffer plays through once.
+
+#define LOOP_BUFFER     1024    // bytes of song data between the markers
+
+typedef enum {
+    LOOP_IDLE = 0,      // no start marker yet
+    LOOP_RECORDING,     // keeping the bytes after the start marker
+    LOOP_CLOSING,       // the end marker was reached, events at its time still come
+    LOOP_PLAYING,       // the region repeats
+    LOOP_OFF            // too long or broken, the song plays through
+} loop_state_t;
+
+typedef struct {
+    midi_checkpoint_t start;
+    uint32_t end;           // offset after the last byte kept, once playing
+    uint16_t len;           // bytes kept
+    uint16_t pos;           // next byte to decode while playing
+    uint8_t state;          // loop_state_t
+    uint8_t closing;        // the end marker was played, events at its time still play
+    uint8_t wrap;           // the region was played, start over before the next byte
+    on_event_func on_event;
+    on_complete_func on_complete;
+    uint32_t wrap_count;
+    uint8_t buf[LOOP_BUFFER];
+} loop_t;
+
+void loop_init(loop_t *loop);
+// from on_event, every MARKER/CUE_MARKER event
+void loop_marker(loop_t *loop, midi_context_t *ctx, const midi_event_t *event);
+// from on_event before the event plays, 0 when it is past the region
+int loop_event(loop_t *loop, midi_context_t *ctx, const midi_event_t *event);
+// after buf, taken from the song at offset, was decoded
+void loop_record(loop_t *loop, midi_context_t *ctx, uint32_t offset, const uint8_t *buf, uint16_t len);
+// while LOOP_PLAYING: the next BUF_SIZE bytes of the region, wraps at its
+// end; MIDI_ABORT leaves ctx in the middle of the region, the song after
+// it was dropped, reset the player
+int loop_play(loop_t *loop, midi_context_t *ctx);
+
+#endif
@@ -0,0 +1,23 @@
+// generated by TOOLS/gen_loudness_table.c, do not edit
+
+#include "loudness_table.h"
+
+const uint8_t loudness_duty[LOUDNESS_STEPS][LOUDNESS_STEPS] = {
+    {  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0},   // velocity 0
+    {  0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1},   // velocity 8
+    {  0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1},   // velocity 16
+    {  0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   3,   3},   // velocity 24
+    {  0,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   3,   3,   4,   5,   5},   // velocity 32
+    {  0,   1,   1,   1,   1,   1,   1,   2,   2,   3,   3,   4,   5,   5,   6,   7,   8},   // velocity 40
+    {  0,   1,   1,   1,   1,   1,   2,   2,   3,   4,   5,   6,   7,   8,   9,  10,  12},   // velocity 48
+    {  0,   1,   1,   1,   1,   2,   2,   3,   4,   5,   6,   8,   9,  11,  12,  14,  16},   // velocity 56
+    {  0,   1,   1,   1,   1,   2,   3,   4,   5,   7,   8,  10,  12,  14,  16,  19,  21},   // velocity 64
+    {  0,   1,   1,   1,   2,   3,   4,   5,   7,   8,  10,  13,  15,  18,  21,  24,  27},   // velocity 72
+    {  0,   1,   1,   1,   2,   3,   5,   6,   8,  10,  13,  16,  19,  22,  26,  30,  33},   // velocity 80
+    {  0,   1,   1,   1,   2,   4,   6,   8,  10,  13,  16,  19,  23,  27,  31,  36,  41},   // velocity 88
+    {  0,   1,   1,   2,   3,   5,   7,   9,  12,  15,  19,  23,  27,  32,  38,  44,  50},   // velocity 96
+    {  0,   1,   1,   2,   3,   5,   8,  11,  14,  18,  22,  27,  32,  38,  45,  52,  60},   // velocity 104
+    {  0,   1,   1,   2,   4,   6,   9,  12,  16,  21,  26,  31,  38,  45,  53,  63,  73},   // velocity 112
+    {  0,   1,   1,   3,   5,   7,  10,  14,  19,  24,  30,  36,  44,  52,  63,  75,  90},   // velocity 120
+    {  0,   1,   1,   3,   5,   8,  12,  16,  21,  27,  33,  41,  50,  60,  73,  90, 128},   // velocity 127
+};
@@ -0,0 +1,20 @@
+#ifndef __LOUDNESS_TABLE_H
+#define __LOUDNESS_TABLE_H
+
+#include <stdint.h>
+
+#define LOUDNESS_STEP   8       // MIDI values per table step
+#define LOUDNESS_STEPS  17      // 0..127 rounded up to steps of 8, step 0 is silence
+
+// PWM duty in 1/256 of the period for [velocity step][channel gain step],
+// at most 128: past 50% a piezo gets quieter again
+extern const uint8_t loudness_duty[LOUDNESS_STEPS][LOUDNESS_STEPS];
+
+// gain is the channel volume (CC7) times expression (CC11), 0..127
+static inline uint8_t loudness_lookup(uint8_t velocity, uint8_t gain)
+{
+    return loudness_duty[((velocity & 0x7f) + LOUDNESS_STEP - 1) / LOUDNESS_STEP]
+                        [((gain & 0x7f) + LOUDNESS_STEP - 1) / LOUDNESS_STEP];
+}
+
+#endif
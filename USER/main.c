@@ -4,48 +4,266 @@
 #include "serial.h"
 #include "pwm.h"
 #include "led.h"
+#ifdef PWM_DMA_SEQ
+#include "seq.h"
+#endif
+#ifdef MIDI_STATS
+#include "dwt.h"
+#endif
 
 #include "midi.h"
+#include "voice.h"
+#include "note_table.h"
+#include "pitch.h"
+#include "envelope.h"
+#include "drum.h"
+#include "loudness_table.h"
+#ifdef MIDI_SKYLINE
+#include "skyline.h"
+#endif
+#ifdef MIDI_LOOP
+#include "loop.h"
+#endif
 
 #define MIDI_MAGIC 0xbeefu
+// a song frame whose header carries a transpose instead of a channel,
+// all channels play
+#define MIDI_MAGIC_V2 0xbef2u
+// a frame with this magic carries a command instead of song data, it
+// skips the song frame and is run by the next control tick
+#define CMD_MAGIC 0xc0deu
+// a song frame holding a midi_checkpoint_t instead of song data, the
+// song goes on from the checkpoint's offset with the next song frame
+#define SEEK_MAGIC 0x5eecu
+// device to host, the answer to CMD_QUERY
+#define TLM_MAGIC 0x7e1eu
+#define CMD_RATE            0x01    // uint16 Q8 playback speed, MIDI_RATE_UNITY as written
+#define CMD_TRANSPOSE       0x02    // int8 semitones on top of the song's
+#define CMD_PAUSE           0x03
+#define CMD_RESUME          0x04
+#define CMD_STOP            0x05    // silence now, drop the rest of the song
+#define CMD_QUERY           0x06    // answered with a Telemetry frame
+#define CONTROL_QUEUE       4       // power of two
+#define CONTROL_PAYLOAD     4       // command and arguments, longer frames are cut
+#define RESYNC_US           50000   // later than this the song timing starts over
+// pitch kept by a silent voice, any note will do, a short period
+// lets the next note take over quickly
+#define REST_NOTE 69
+
+#define BEND_RANGE_DEFAULT  2       // semitones, General MIDI default
+#define BEND_RANGE_MAX      24
+#define VIBRATO_RATE        5       // Hz
+#define VIBRATO_DEPTH       128     // 1/256 semitone at full CC1, half a semitone
+// LFO phase step per control tick, the phase wraps at 65536
+#define LFO_STEP            (65536u * VIBRATO_RATE / 1000)
+
+#ifdef PWM_DMA_SEQ
+// nothing ticks the envelopes, notes are plain rectangles
+#define ENV_SHAPE           env_shape_gate
+#else
+#define ENV_SHAPE           env_shape_default
+#endif
+
+#define CC_MODULATION       1
+#define CC_DATA_ENTRY       6
+#define CC_VOLUME           7
+#define CC_EXPRESSION       11
+#define CC_SUSTAIN          64
+#define CC_ALL_SOUND_OFF    120
+#define CC_ALL_NOTES_OFF    123
+#define CC_RPN_LSB          100
+#define CC_RPN_MSB          101
 
 void decodeHeader(uint8_t byte);
 void decodePayload(uint8_t byte);
-void buzzerPlay(uint8_t channel, uint32_t us, uint32_t frequency, uint32_t duty);
+void decodeControl(uint8_t byte);
+void buzzerWait(uint32_t us);
+void buzzerSet(uint8_t voice);
+void buzzerFlush(void);
+void buzzerPlay(uint8_t voice, uint32_t us, uint8_t channel, uint8_t note, uint8_t velocity);
+void buzzerRelease(uint8_t voice, uint32_t us);
+void buzzerUpdateChannel(uint8_t channel);
+void playDrum(uint32_t delta, uint8_t note, uint8_t velocity);
+void onControlTick(void);
+void onControlChange(uint8_t channel, uint8_t control, uint8_t value);
+void releaseHeld(uint8_t channel);
+void silenceChannel(uint8_t channel);
+void resetChannels(void);
+void playEvent(midi_event_t *event);
 void onMidiEvent(midi_context_t *ctx, midi_event_t *event);
+#ifdef MIDI_SKYLINE
+void onSkylineEvent(void *user, midi_event_t *event);
+#endif
 void onMidiComplete(midi_context_t *ctx);
+void initContext(midi_context_t *ctx);
+void resetPlayer(midi_context_t *ctx);
+void seekPlayer(midi_context_t *ctx);
+void prefetchSong(void);
+void playFrame(uint8_t prefetched);
+void updateTranspose(void);
+void runControl(void);
+void sendTelemetry(void);
+void onWaitIdle(void);
 
 typedef struct {
     uint16_t magic;
     uint8_t seqid;
-    uint8_t channel_id;
+    // read with the first frame of a song
+    union {
+        uint8_t channel_id; // MIDI_MAGIC: the channel played besides channel 0
+        int8_t transpose;   // MIDI_MAGIC_V2, SEEK_MAGIC: semitones for the whole song
+    };
     uint8_t payload_size;
 } __attribute__((packed)) MidiHeader;
 
+void readSongHeader(const MidiHeader *header);
+
 typedef struct {
     MidiHeader header;
-    uint8_t payload[32];
+    uint8_t payload[44];    // 32 of song data or a midi_checkpoint_t
 } __attribute__((packed)) MidiMessage;
 
-uint8_t gHasNewMessage = 0;
+typedef struct {
+    uint8_t seqid;
+    uint8_t size;
+    uint8_t payload[CONTROL_PAYLOAD];
+#ifdef MIDI_STATS
+    uint32_t stamp;         // cycles when the last byte came in
+#endif
+} ControlFrame;
+
+#define TLM_PLAYING     0x01    // inside a song
+#define TLM_PAUSED      0x02
+#define TLM_STOPPING    0x04
+
+typedef struct {
+    uint8_t state;          // TLM_*
+    uint8_t seqid;          // last song or seek frame taken
+    int8_t transpose;
+    uint16_t rate;
+    uint32_t position;      // us into the song
+    uint32_t stopLatency;   // cycles from the last stop frame to silence, 0 without MIDI_STATS
+} __attribute__((packed)) Telemetry;
+
+typedef struct {
+    int16_t bend;           // -8192..8191
+    uint8_t bendRange;      // semitones
+    uint8_t modulation;     // CC1
+    uint8_t volume;         // CC7
+    uint8_t expression;     // CC11
+    uint8_t gain;           // volume * expression, 0..127
+    uint8_t sustain;        // CC64 pedal down
+    // note offs deferred by the pedal, one bit per note
+    uint32_t held[4];
+    uint8_t rpnMsb;
+    uint8_t rpnLsb;
+} ChannelState;
+
+// what a buzzer plays, read by the control tick, so it is a copy of the
+// allocator state that only changes with the interrupts off
+typedef struct {
+    uint8_t channel;
+    uint8_t note;
+    uint8_t key;            // the note that sounds, transposed and folded into the buzzer range
+    uint8_t velocity;
+    uint8_t duty;           // 1/256 of the period at full envelope level, from loudness_duty
+    envelope_t envelope;    // silent when idle
+    const drum_pattern_t *drum; // NULL for a melodic note
+} VoiceOutput;
+
+// register values of a buzzer, computed before they are written
+typedef struct {
+    note_period_t period;
+    uint16_t compare;
+    uint16_t spread;        // noise mask, 0 for a tone
+} VoiceRegs;
+
+volatile uint8_t gHasNewMessage = 0;
 uint8_t gDecodeLen = 0;
-MidiMessage gMessage = {0};
+MidiHeader gRxHeader;           // of the frame coming in, song or control
+MidiMessage gMessage = {0};     // filled by the serial interrupt
+MidiMessage gFrame = {0};       // being played, the next one comes into gMessage
+ControlFrame gControls[CONTROL_QUEUE];
+volatile uint8_t gControlHead = 0;  // moved by the control tick
+volatile uint8_t gControlTail = 0;  // moved by the serial interrupt
+volatile uint8_t gPaused = 0;
+volatile uint8_t gStopping = 0;     // set by CMD_STOP until the player is reset
+volatile uint8_t gTelemetryPending = 0;
+uint8_t gTelemetrySeqid = 0;
+uint32_t gPosition = 0;         // us waited in the song
 OnReadableFunc gDecodeFunc = 0;
 midi_context_t gMidiCtx = {0};
+midi_context_t gNextCtx = {0};  // the next song's headers, parsed while this one plays
+uint8_t gNextLen = 0;           // bytes of gMessage gNextCtx parsed
+#ifndef PWM_DMA_SEQ
+uint32_t gDeadline = 0;         // end of the last wait, the next one counts from it
+#endif
+voice_allocator_t gVoices = {0};
+ChannelState gChannels[VOICE_CHANNELS];
+VoiceOutput gOutputs[PWM_VOICE_NUM];
+uint16_t gLfoPhase = 0;
+int8_t gDrumVoice = VOICE_NONE;
+uint8_t gDrumNote = 0;
+volatile uint8_t gDirty = 0;    // voices staged for the next buzzerFlush
+int8_t gSongTranspose = 0;      // from the stream header
+uint16_t gSongDrop = 0;         // channels the stream header leaves out
+int8_t gUserTranspose = 0;      // CMD_TRANSPOSE
+int8_t gTranspose = 0;          // both, what buzzerPlay folds with
+uint16_t gRate = MIDI_RATE_UNITY;   // CMD_RATE, kept across songs
+#ifdef MIDI_SKYLINE
+skyline_t gSkyline;             // melodic channels down to one line
+#endif
+#ifdef MIDI_LOOP
+loop_t gLoop;                   // marker loop region, replayed from RAM
+#endif
+#ifdef MIDI_STATS
+volatile uint32_t gControlCycles = 0;       // cost of the last control tick
+volatile uint32_t gControlCyclesMax = 0;
+uint32_t gDrumHits = 0;
+uint32_t gWaitCycles = 0;
+uint32_t gEventCount = 0;
+uint32_t gEventCycles = 0;      // spent in onMidiEvent, waits excluded
+uint32_t gEventCyclesMax = 0;
+uint32_t gBatchStart = 0;       // end of the last wait, when the batch is due
+uint32_t gBatchFirst = 0;       // first register write of the batch
+uint8_t gBatchDue = 0;          // a wait set gBatchStart
+uint8_t gBatchWritten = 0;
+uint32_t gBatchCount = 0;
+uint32_t gBatchLatencyMax = 0;  // due to the last register write
+uint32_t gBatchSkewMax = 0;     // first to last register write
+uint32_t gStopLatency = 0;      // end of the stop frame to the silenced registers
+uint32_t gStopLatencyMax = 0;
+#ifndef PWM_DMA_SEQ
+int32_t gSongGap = 0;           // us the last song switch was late, 0 is gapless
+uint32_t gSongEnd = 0;          // deadline of the last song's last event
+uint8_t gSongEnded = 0;
+uint8_t gGapPending = 0;        // measured by the first register write
+#endif
+#endif
 
 void decodeHeader(uint8_t byte)
 {
-    uint8_t *ptr = (uint8_t *)&(gMessage.header);
+    uint8_t *ptr = (uint8_t *)&gRxHeader;
     
     ptr[gDecodeLen++] = byte;
     if (gDecodeLen < sizeof(MidiHeader)) {
         return;
     }
 
-    while (gMessage.header.magic != (uint16_t)MIDI_MAGIC) ;
+    while (gRxHeader.magic != (uint16_t)MIDI_MAGIC && gRxHeader.magic != (uint16_t)MIDI_MAGIC_V2
+        && gRxHeader.magic != (uint16_t)CMD_MAGIC && gRxHeader.magic != (uint16_t)SEEK_MAGIC) ;
 
     gDecodeLen = 0;
-    gDecodeFunc = decodePayload;
+    if (gRxHeader.magic == (uint16_t)CMD_MAGIC && gRxHeader.payload_size == 0) {
+        // nothing to run
+        return;
+    } else if (gRxHeader.magic == (uint16_t)CMD_MAGIC) {
+        // may come in while a song frame plays, it has its own queue
+        gDecodeFunc = decodeControl;
+    } else {
+        gMessage.header = gRxHeader;
+        gDecodeFunc = decodePayload;
+    }
 }
 
 void decodePayload(uint8_t byte)
@@ -64,64 +282,823 @@ void decodePayload(uint8_t byte)
     gHasNewMessage = 1;
 }
 
+void decodeControl(uint8_t byte)
+{
+    uint8_t tail = gControlTail;
+    // a full queue drops the frame
+    uint8_t full = (uint8_t)(tail - gControlHead) == CONTROL_QUEUE;
+    ControlFrame *frame = &gControls[tail & (CONTROL_QUEUE - 1)];
+
+    if (!full && gDecodeLen < CONTROL_PAYLOAD) {
+        frame->payload[gDecodeLen] = byte;
+    }
+    gDecodeLen += 1;
+    if (gDecodeLen < gRxHeader.payload_size) {
+        return;
+    }
+
+    if (!full) {
+        frame->seqid = gRxHeader.seqid;
+        frame->size = MIN(gDecodeLen, CONTROL_PAYLOAD);
+#ifdef MIDI_STATS
+        frame->stamp = DWT_GetCycles();
+#endif
+        gControlTail = tail + 1;
+    }
+    gDecodeLen = 0;
+    gDecodeFunc = decodeHeader;
+}
+
 void onReadable(uint8_t byte)
 {
     gDecodeFunc(byte);
 }
 
-void buzzerPlay(uint8_t channel, uint32_t us, uint32_t frequency, uint32_t duty)
+void buzzerWait(uint32_t us)
 {
-    delay_us(us);
+    if (us == 0 || gStopping) {
+        // same timestamp, keep staging
+        return;
+    }
+    buzzerFlush();
+    gPosition += us;
 
-    // the sysclock is 72MHz,
-    // and prescaler=72 is set in pwm.c,
-    // so we use 1000000 = 72MHz/72
-    uint32_t period = 1000000 / frequency;
-    uint32_t compareValue = (period * duty) / 100;
-    PWM_SetAutoreload(channel, period - 1);
-    PWM_SetCompare1(channel, compareValue);
+#ifdef MIDI_STATS
+    uint32_t cycles = DWT_GetCycles();
+#endif
+#ifdef PWM_DMA_SEQ
+    onWaitIdle();
+    // queued as a step, the timers keep the time, onWaitIdle runs while
+    // it sleeps for room (also paused)
+    SEQ_Wait(us);
+#else
+    // from the end of the last wait, the time spent decoding and
+    // between songs is not added to the song; a long stall starts over
+    if ((int32_t)(delay_now_us() - gDeadline) > RESYNC_US) {
+        gDeadline = delay_now_us();
+    }
+    gDeadline += us;
+    // a stop ends the wait, a pause moves its end
+    while (!gStopping && (gPaused || (int32_t)(delay_now_us() - gDeadline) < 0)) {
+        if (gPaused) {
+            uint32_t paused = delay_now_us();
+            while (gPaused && !gStopping) {
+                onWaitIdle();
+            }
+            gDeadline += delay_now_us() - paused;
+        }
+        onWaitIdle();
+    }
+#endif
+#ifdef MIDI_STATS
+    gBatchStart = DWT_GetCycles();
+    gBatchDue = 1;
+    gBatchWritten = 0;
+    gWaitCycles += gBatchStart - cycles;
+#endif
 }
 
-void onMidiEvent(midi_context_t *ctx, midi_event_t *event)
+// pitch of a channel in 1/256 semitone, bend plus vibrato
+static int32_t channelPitch(uint8_t channel)
+{
+    const ChannelState *state = &gChannels[channel];
+    int32_t pitch = (int32_t)state->bend * state->bendRange / 32;
+
+    if (state->modulation) {
+        // triangle LFO, -16384..16383
+        int32_t lfo = gLfoPhase < 32768 ? gLfoPhase : 65535 - gLfoPhase;
+        lfo -= 16384;
+        pitch += (lfo * state->modulation * VIBRATO_DEPTH) >> 21;
+    }
+    return pitch;
+}
+
+static void buzzerCompute(uint8_t voice, VoiceRegs *regs)
+{
+    const VoiceOutput *output = &gOutputs[voice];
+    const drum_pattern_t *drum = output->drum;
+
+    regs->compare = 0;
+    regs->spread = 0;
+
+    if (output->envelope.stage != ENV_IDLE) {
+        int32_t pitch;
+        if (drum) {
+            // chirps fall with the level, noise keeps its note
+            pitch = PITCH_NOTE(drum->to) + PITCH_NOTE(drum->from - drum->to) * output->envelope.level / ENV_LEVEL_MAX;
+        } else {
+            pitch = PITCH_NOTE(output->key) + channelPitch(output->channel);
+        }
+        pitch_to_period(pitch, &regs->period);
+#ifndef PWM_DMA_SEQ
+        if (drum && drum->kind == DRUM_NOISE) {
+            // the noise periods run from half the note's period up,
+            // the mask is the largest 2^n-1 not above the base period
+            uint16_t spread = regs->period.autoreload >>= 1;
+            spread |= spread >> 1;
+            spread |= spread >> 2;
+            spread |= spread >> 4;
+            spread |= spread >> 8;
+            regs->spread = spread >> 1;
+        }
+#endif
+        // at most 65536 * 128 * 255, no overflow
+        regs->compare = ((uint32_t)(regs->period.autoreload + 1) * output->duty * output->envelope.level) >> 16;
+    } else {
+        regs->period = note_periods[REST_NOTE];
+    }
+}
+
+// runs with the interrupts off or from the control tick, a pause or stop
+// read here can't be missed by registers computed before it
+static void buzzerApply(uint8_t voice, const VoiceRegs *regs)
+{
+    uint16_t compare = gPaused || gStopping ? 0 : regs->compare;
+#ifdef PWM_DMA_SEQ
+    SEQ_SetVoice(voice, regs->period.prescaler, regs->period.autoreload, compare);
+#else
+    PWM_SetVoice(voice, regs->period.prescaler, regs->period.autoreload, compare);
+    if (regs->spread && compare) {
+        PWM_NoiseStart(voice, regs->period.autoreload, regs->spread);
+    } else {
+        PWM_NoiseStop(voice);
+    }
+#endif
+}
+
+// the caller keeps the interrupts off, the control tick writes the same registers
+void buzzerSet(uint8_t voice)
+{
+    VoiceRegs regs;
+
+    buzzerCompute(voice, &regs);
+    buzzerApply(voice, &regs);
+}
+
+// the voice changed, the registers are written by the next buzzerFlush
+static inline void buzzerStage(uint8_t voice)
+{
+    gDirty |= 1u << voice;
+#ifdef MIDI_NO_BATCH
+    buzzerFlush();
+#endif
+}
+
+// Events that share a timestamp only stage their voices. They are
+// written here, before the next wait and at the end of every decoded
+// buffer: the periods are computed first, then all the registers are
+// written back to back with the interrupts off.
+void buzzerFlush(void)
+{
+    VoiceRegs regs[PWM_VOICE_NUM];
+    uint8_t dirty = gDirty;
+
+    if (!dirty) {
+        return;
+    }
+
+    __disable_irq();
+    for (uint8_t i = 0; i < PWM_VOICE_NUM; ++i) {
+        if (dirty & (1u << i)) {
+            buzzerCompute(i, &regs[i]);
+        }
+    }
+#ifdef MIDI_STATS
+    uint32_t first = DWT_GetCycles();
+#endif
+    for (uint8_t i = 0; i < PWM_VOICE_NUM; ++i) {
+        if (dirty & (1u << i)) {
+            buzzerApply(i, &regs[i]);
+        }
+    }
+    gDirty = 0;
+    __enable_irq();
+
+#ifdef MIDI_STATS
+#ifndef PWM_DMA_SEQ
+    if (gGapPending) {
+        gGapPending = 0;
+        gSongGap = (int32_t)(delay_now_us() - gSongEnd - gPosition);
+    }
+#endif
+    uint32_t now = DWT_GetCycles();
+    if (gBatchDue) {
+        if (!gBatchWritten) {
+            gBatchWritten = 1;
+            gBatchFirst = first;
+            gBatchCount += 1;
+        }
+        if (now - gBatchStart > gBatchLatencyMax) {
+            gBatchLatencyMax = now - gBatchStart;
+        }
+        if (now - gBatchFirst > gBatchSkewMax) {
+            gBatchSkewMax = now - gBatchFirst;
+        }
+    }
+#endif
+}
+
+// velocity 0 silences the voice right away
+void buzzerPlay(uint8_t voice, uint32_t us, uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    buzzerWait(us);
+
+    __disable_irq();
+    gOutputs[voice].channel = channel;
+    gOutputs[voice].note = note & 0x7f;
+    gOutputs[voice].key = note_fold_lookup(note, gTranspose);
+    gOutputs[voice].velocity = velocity;
+    gOutputs[voice].duty = loudness_lookup(velocity, gChannels[channel].gain);
+    gOutputs[voice].drum = NULL;
+    if (velocity) {
+        envelope_start(&gOutputs[voice].envelope, &ENV_SHAPE);
+    } else {
+        envelope_reset(&gOutputs[voice].envelope);
+    }
+    __enable_irq();
+    buzzerStage(voice);
+}
+
+// note off, the control tick fades the voice out
+void buzzerRelease(uint8_t voice, uint32_t us)
+{
+    buzzerWait(us);
+
+    __disable_irq();
+    envelope_release(&gOutputs[voice].envelope);
+    __enable_irq();
+    buzzerStage(voice);
+}
+
+// bend or loudness changed, push it to the sounding notes of the channel,
+// a table lookup per voice
+void buzzerUpdateChannel(uint8_t channel)
+{
+    for (uint8_t i = 0; i < PWM_VOICE_NUM; ++i) {
+        VoiceOutput *output = &gOutputs[i];
+        if (output->envelope.stage != ENV_IDLE && output->channel == channel) {
+            __disable_irq();
+            output->duty = loudness_lookup(output->velocity, gChannels[channel].gain);
+            __enable_irq();
+            buzzerStage(i);
+        }
+    }
+}
+
+// GM percussion, a one-shot burst that ends with its envelope
+void playDrum(uint32_t delta, uint8_t note, uint8_t velocity)
+{
+#ifdef PWM_DMA_SEQ
+    // no control tick to run the bursts, the hit only keeps its time
+    buzzerWait(delta);
+#else
+    const drum_pattern_t *pattern = drum_pattern(note);
+
+    buzzerWait(delta);
+    if (pattern == NULL) {
+        return;
+    }
+
+    // one voice for all the drums, a new hit cuts the previous one,
+    // so dense drum tracks never take more than a voice and its noise interrupt
+    if (gDrumVoice != VOICE_NONE && gOutputs[gDrumVoice].drum) {
+        voice_note_off(&gVoices, DRUM_CHANNEL, gDrumNote);
+        buzzerPlay(gDrumVoice, 0, DRUM_CHANNEL, gDrumNote, 0);
+    }
+
+    int voice = voice_note_on(&gVoices, DRUM_CHANNEL, note, velocity);
+    if (voice == VOICE_NONE) {
+        return;
+    }
+    gDrumVoice = voice;
+    gDrumNote = note;
+
+    __disable_irq();
+    gOutputs[voice].channel = DRUM_CHANNEL;
+    gOutputs[voice].note = note;
+    gOutputs[voice].velocity = velocity;
+    gOutputs[voice].duty = loudness_lookup(velocity, gChannels[DRUM_CHANNEL].gain);
+    gOutputs[voice].drum = pattern;
+    envelope_start(&gOutputs[voice].envelope, &pattern->shape);
+    __enable_irq();
+    buzzerStage(voice);
+#ifdef MIDI_STATS
+    gDrumHits += 1;
+#endif
+#endif
+}
+
+// SysTick, 1kHz: control frames, envelopes and vibrato
+void onControlTick(void)
+{
+#ifdef MIDI_STATS
+    uint32_t cycles = DWT_GetCycles();
+#endif
+
+    runControl();
+    // frozen while paused, silent while stopping
+    if (gPaused || gStopping) {
+        return;
+    }
+
+    gLfoPhase += LFO_STEP;
+    for (uint8_t i = 0; i < PWM_VOICE_NUM; ++i) {
+        VoiceOutput *output = &gOutputs[i];
+        uint8_t update = 0;
+
+        // staged by an unfinished batch, written by buzzerFlush
+        if (gDirty & (1u << i)) {
+            continue;
+        }
+        if (envelope_moving(&output->envelope)) {
+            envelope_tick(&output->envelope);
+            update = 1;
+        }
+        if (output->envelope.stage != ENV_IDLE && gChannels[output->channel].modulation) {
+            update = 1;
+        }
+        if (update) {
+            buzzerSet(i);
+        }
+    }
+
+#ifdef MIDI_STATS
+    cycles = DWT_GetCycles() - cycles;
+    gControlCycles = cycles;
+    if (cycles > gControlCyclesMax) {
+        gControlCyclesMax = cycles;
+    }
+#endif
+}
+
+static inline void heldSet(ChannelState *state, uint8_t note)
+{
+    state->held[note >> 5] |= 1u << (note & 31);
+}
+
+static inline void heldClear(ChannelState *state, uint8_t note)
+{
+    state->held[note >> 5] &= ~(1u << (note & 31));
+}
+
+// pedal lifted, release the deferred notes in one go
+void releaseHeld(uint8_t channel)
+{
+    ChannelState *state = &gChannels[channel];
+
+    for (uint8_t i = 0; i < 4; ++i) {
+        uint32_t bits = state->held[i];
+        state->held[i] = 0;
+        while (bits) {
+            uint8_t note = (i << 5) | __builtin_ctz(bits);
+            bits &= bits - 1;
+            // stolen notes are gone already
+            int voice = voice_note_off(&gVoices, channel, note);
+            if (voice != VOICE_NONE) {
+                buzzerRelease(voice, 0);
+            }
+        }
+    }
+}
+
+// CC120/CC123: cut every voice of the channel, no release
+void silenceChannel(uint8_t channel)
+{
+    ChannelState *state = &gChannels[channel];
+
+    memset(state->held, 0, sizeof(state->held));
+    for (uint8_t i = 0; i < PWM_VOICE_NUM; ++i) {
+        if (gOutputs[i].envelope.stage != ENV_IDLE && gOutputs[i].channel == channel) {
+            voice_note_off(&gVoices, channel, gOutputs[i].note);
+            buzzerPlay(i, 0, channel, gOutputs[i].note, 0);
+        }
+    }
+}
+
+void onControlChange(uint8_t channel, uint8_t control, uint8_t value)
+{
+    ChannelState *state = &gChannels[channel];
+
+    switch (control) {
+    case CC_MODULATION:
+        state->modulation = value;
+        break;
+    case CC_VOLUME:
+    case CC_EXPRESSION:
+        if (control == CC_VOLUME) {
+            state->volume = value;
+        } else {
+            state->expression = value;
+        }
+        state->gain = (state->volume * state->expression + 63) / 127;
+        buzzerUpdateChannel(channel);
+        break;
+    case CC_SUSTAIN:
+        state->sustain = value >= 64;
+        if (!state->sustain) {
+            releaseHeld(channel);
+        }
+        break;
+    case CC_ALL_SOUND_OFF:
+    case CC_ALL_NOTES_OFF:
+        silenceChannel(channel);
+        break;
+    case CC_RPN_MSB:
+        state->rpnMsb = value;
+        break;
+    case CC_RPN_LSB:
+        state->rpnLsb = value;
+        break;
+    case CC_DATA_ENTRY:
+        // RPN 0,0 is the pitch bend range
+        if (state->rpnMsb == 0 && state->rpnLsb == 0) {
+            state->bendRange = MIN(value, BEND_RANGE_MAX);
+            buzzerUpdateChannel(channel);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void resetChannels(void)
+{
+    for (uint8_t i = 0; i < VOICE_CHANNELS; ++i) {
+        gChannels[i].bend = 0;
+        gChannels[i].bendRange = BEND_RANGE_DEFAULT;
+        gChannels[i].modulation = 0;
+        // General MIDI defaults
+        gChannels[i].volume = 100;
+        gChannels[i].expression = 127;
+        gChannels[i].gain = 100;
+        gChannels[i].sustain = 0;
+        memset(gChannels[i].held, 0, sizeof(gChannels[i].held));
+        // no RPN selected
+        gChannels[i].rpnMsb = 0x7f;
+        gChannels[i].rpnLsb = 0x7f;
+    }
+}
+
+void playEvent(midi_event_t *event)
 {
     // simpler is better:
-    // just focus on&off, ignore others
+    // notes, drums, pitch bend, modulation, loudness and sustain, ignore others
 
     uint8_t channel = event->status & 0x0f;
     uint32_t delta = event->delta;
     uint8_t type = event->status & 0xf0;
 
-    if (type == NOTE_ON || type == NOTE_OFF) {
-        uint32_t freq = midi_note_to_freq(event->param1);
-        // the max duty is 127 in MIDI
-        uint32_t duty = event->param2;
-        if (duty > 127) {
-            duty = 127;
-        } else if (type == NOTE_OFF) {
-            duty = 0;
+    // the rest of a stopped song's frame is decoded into nothing
+    if (gStopping) {
+        return;
+    }
+
+    if (type == NOTE_ON && event->param2 > 0) {
+        uint8_t note = event->param1;
+        uint8_t velocity = event->param2 & 0x7f;
+
+        if (channel == DRUM_CHANNEL) {
+            playDrum(delta, note, velocity);
+            return;
         }
-        duty = duty / 127. * 100;
 
-        if (channel == 0 || channel == gMessage.header.channel_id) {
-            buzzerPlay(channel, delta, freq, duty);
+        // a struck again note is no longer waiting for the pedal
+        heldClear(&gChannels[channel], note);
+        int voice = voice_note_on(&gVoices, channel, note, velocity);
+        if (voice != VOICE_NONE) {
+            buzzerPlay(voice, delta, channel, note, velocity);
         } else {
-            delay_us(delta);
+            buzzerWait(delta);
         }
+    } else if ((type == NOTE_ON || type == NOTE_OFF) && gChannels[channel].sustain
+            && channel != DRUM_CHANNEL && voice_note_test(&gVoices, channel, event->param1)) {
+        // the pedal holds the note, released with the others when it lifts
+        heldSet(&gChannels[channel], event->param1 & 0x7f);
+        buzzerWait(delta);
+    } else if (type == NOTE_ON || type == NOTE_OFF) {
+        // only release the voice if it still plays this very note,
+        // drum bursts are one-shot, their note off only frees the allocator
+        int voice = voice_note_off(&gVoices, channel, event->param1);
+        if (voice != VOICE_NONE && channel != DRUM_CHANNEL) {
+            buzzerRelease(voice, delta);
+        } else {
+            buzzerWait(delta);
+        }
+    } else if (type == PITCHWHEEL) {
+        buzzerWait(delta);
+        gChannels[channel].bend = (int16_t)(((event->param2 & 0x7f) << 7 | (event->param1 & 0x7f)) - 8192);
+        buzzerUpdateChannel(channel);
+    } else if (type == CONTROL_CHANGE) {
+        buzzerWait(delta);
+        onControlChange(channel, event->param1, event->param2);
     } else {
-        delay_us(delta);
+        buzzerWait(delta);
+    }
+}
+
+void onMidiEvent(midi_context_t *ctx, midi_event_t *event)
+{
+#ifdef MIDI_STATS
+    uint32_t cycles = DWT_GetCycles();
+    uint32_t waited = gWaitCycles;
+#endif
+
+    // CMD_RATE from the control tick, applied between events
+    if (ctx->rate != gRate) {
+        midi_set_rate(ctx, gRate);
     }
+
+#ifdef MIDI_LOOP
+    if (!loop_event(&gLoop, ctx, event)) {
+        // past the loop's end, the region starts over instead
+        return;
+    }
+#endif
+#ifdef MIDI_SKYLINE
+    skyline_push(&gSkyline, event);
+#else
+    playEvent(event);
+#endif
+#ifdef MIDI_LOOP
+    // after its delta was waited, a wrap lands on the end marker's time
+    if (event->is_meta && (event->status == MARKER || event->status == CUE_MARKER)) {
+        loop_marker(&gLoop, ctx, event);
+    }
+#endif
+
+#ifdef MIDI_STATS
+    // the waits are the music, not the cost of the event
+    cycles = DWT_GetCycles() - cycles - (gWaitCycles - waited);
+    gEventCount += 1;
+    gEventCycles += cycles;
+    if (cycles > gEventCyclesMax) {
+        gEventCyclesMax = cycles;
+    }
+#endif
 }
 
+#ifdef MIDI_SKYLINE
+void onSkylineEvent(void *user, midi_event_t *event)
+{
+    playEvent(event);
+}
+#endif
+
 void onMidiComplete(midi_context_t *ctx)
 {
-    gDecodeLen = 0;
-    gDecodeFunc = decodeHeader;
+#if defined(MIDI_STATS) && !defined(PWM_DMA_SEQ)
+    gSongEnd = gDeadline;
+    gSongEnded = 1;
+#endif
+    // the serial side is between song frames already and may be in the
+    // middle of a control frame, it is left alone
+    resetPlayer(ctx);
+}
 
+// the event types playEvent ignores are dropped by the decoder, they
+// cost no callback and their delta goes to the next event
+void initContext(midi_context_t *ctx)
+{
     memset(ctx, 0, sizeof(*ctx));
     ctx->on_event = onMidiEvent;
     ctx->on_complete = onMidiComplete;
-    buzzerPlay(0, 0, 100, 0);
-    buzzerPlay(1, 0, 100, 0);
+    ctx->type_drop = MIDI_TYPE_BIT(POLYTOUCH) | MIDI_TYPE_BIT(PROGRAM_CHANGE) | MIDI_TYPE_BIT(AFTERTOUCH);
+    midi_set_rate(ctx, gRate);
+}
+
+// end of a song or a stop: fresh decoder, channels and silent voices
+void resetPlayer(midi_context_t *ctx)
+{
+#ifdef MIDI_SKYLINE
+    // the tail of the song is still in the lookahead window
+    skyline_flush(&gSkyline);
+    skyline_init(&gSkyline, onSkylineEvent, 0);
+#endif
+#ifdef MIDI_LOOP
+    loop_init(&gLoop);
+#endif
+    initContext(ctx);
+    voice_init(&gVoices, PWM_VOICE_NUM, VOICE_STEAL_LRU);
+    resetChannels();
+    gDrumVoice = VOICE_NONE;
+    gPosition = 0;
+    for (uint8_t i = 0; i < PWM_VOICE_NUM; ++i) {
+        buzzerPlay(i, 0, 0, REST_NOTE, 0);
+    }
+    buzzerFlush();
+#ifdef PWM_DMA_SEQ
+    SEQ_Flush();
+#endif
+}
+
+// a seek frame: the song starts over at the checkpoint, its sounding
+// notes come back right away
+void seekPlayer(midi_context_t *ctx)
+{
+    midi_checkpoint_t cp;
+
+    resetPlayer(ctx);
+#ifndef PWM_DMA_SEQ
+    gDeadline = delay_now_us();
+#endif
+    // the channels stay those of the song's first frame
+    ctx->channel_drop = gSongDrop;
+    gSongTranspose = gFrame.header.transpose;
+    updateTranspose();
+    memcpy(&cp, gFrame.payload, sizeof(cp));
+    midi_restore(ctx, &cp);
+    gPosition = cp.time_us;
+    buzzerFlush();
+}
+
+// The next song's first frame came in while this one plays its last
+// events, its header and track header are parsed now so the switch
+// only copies the context. Used only if this song is over by then.
+void prefetchSong(void)
+{
+    const uint8_t len = MIDI_HEADER_LEN + MIDI_TRACK_HEADER_LEN;
+
+    if (!gHasNewMessage || gNextLen
+            || (gMessage.header.magic != (uint16_t)MIDI_MAGIC && gMessage.header.magic != (uint16_t)MIDI_MAGIC_V2)
+            || gMessage.header.payload_size < len || memcmp(gMessage.payload, "MThd", 4) != 0) {
+        return;
+    }
+    initContext(&gNextCtx);
+    if (midi_decode(&gNextCtx, gMessage.payload, len) == MIDI_OK && gNextCtx.status == DECODE_EVENT_DELTA) {
+        gNextLen = len;
+    }
+}
+
+// a song frame, a new song starts when the last one is over
+void playFrame(uint8_t prefetched)
+{
+    uint8_t off = 0;
+
+#ifdef MIDI_LOOP
+    if (gLoop.state == LOOP_PLAYING) {
+        // the song after the loop, never played
+        return;
+    }
+#endif
+    if (gMidiCtx.status == DECODE_HEADER) {
+        if (gFrame.header.payload_size < 4
+                || (memcmp(gFrame.payload, "MThd", 4) != 0 && memcmp(gFrame.payload, "RIFF", 4) != 0)) {
+            // the rest of a stopped song, sent before the stop was seen
+            return;
+        }
+        // its notes are folded from the first event on
+        readSongHeader(&gFrame.header);
+        if (prefetched) {
+            gMidiCtx = gNextCtx;
+            midi_set_rate(&gMidiCtx, gRate);
+            off = prefetched;
+        }
+        gMidiCtx.channel_drop = gSongDrop;
+#if defined(MIDI_STATS) && !defined(PWM_DMA_SEQ)
+        gGapPending = gSongEnded;
+        gSongEnded = 0;
+#endif
+    }
+#ifdef MIDI_LOOP
+    uint32_t offset = gMidiCtx.offset;
+#endif
+    int ret = midi_decode(&gMidiCtx, gFrame.payload + off, gFrame.header.payload_size - off);
+    while (ret != MIDI_OK);
+#ifdef MIDI_LOOP
+    loop_record(&gLoop, &gMidiCtx, offset, gFrame.payload + off, gFrame.header.payload_size - off);
+#endif
+    // the next event may be messages away, don't hold the staged voices
+    buzzerFlush();
+}
+
+// the baseline header picks one channel to play besides channel 0, the
+// newer one a transpose for all channels
+void readSongHeader(const MidiHeader *header)
+{
+    if (header->magic == (uint16_t)MIDI_MAGIC) {
+        uint16_t keep = 1u << 0;
+        if (header->channel_id < VOICE_CHANNELS) {
+            keep |= 1u << header->channel_id;
+        }
+        gSongDrop = ~keep;
+        gSongTranspose = 0;
+    } else {
+        gSongDrop = 0;
+        gSongTranspose = header->transpose;
+    }
+    updateTranspose();
+}
+
+void updateTranspose(void)
+{
+    int16_t transpose = gSongTranspose + gUserTranspose;
+    gTranspose = transpose > NOTE_TRANSPOSE_MAX ? NOTE_TRANSPOSE_MAX
+               : transpose < -NOTE_TRANSPOSE_MAX ? -NOTE_TRANSPOSE_MAX : transpose;
+}
+
+static void runCommand(const ControlFrame *frame)
+{
+    const uint8_t *payload = frame->payload;
+
+    switch (payload[0]) {
+    case CMD_RATE:
+        // both fold into what is precomputed anyway, the microseconds
+        // per tick and the key of a note on, from the next event on
+        if (frame->size >= 3) {
+            uint16_t rate = payload[1] | payload[2] << 8;
+            gRate = rate < MIDI_RATE_MIN ? MIDI_RATE_MIN : rate > MIDI_RATE_MAX ? MIDI_RATE_MAX : rate;
+        }
+        break;
+    case CMD_TRANSPOSE:
+        if (frame->size >= 2) {
+            gUserTranspose = (int8_t)payload[1];
+            updateTranspose();
+        }
+        break;
+    case CMD_PAUSE:
+    case CMD_RESUME:
+    case CMD_STOP:
+        if (payload[0] == CMD_PAUSE) {
+            gPaused = 1;
+        } else if (payload[0] == CMD_RESUME) {
+            gPaused = 0;
+        } else {
+            // main resets the player once the song frame is through
+            gStopping = 1;
+            gPaused = 0;
+        }
+#ifdef PWM_DMA_SEQ
+        // the queued steps belong to the timers, stop or freeze them
+        if (payload[0] == CMD_PAUSE) {
+            SEQ_Pause();
+        } else if (payload[0] == CMD_RESUME) {
+            SEQ_Resume();
+        } else {
+            SEQ_Halt();
+        }
+#else
+        // rewritten muted or back as they were, the envelopes held still
+        for (uint8_t i = 0; i < PWM_VOICE_NUM; ++i) {
+            buzzerSet(i);
+        }
+#endif
+#ifdef MIDI_STATS
+        if (payload[0] == CMD_STOP) {
+            gStopLatency = DWT_GetCycles() - frame->stamp;
+            if (gStopLatency > gStopLatencyMax) {
+                gStopLatencyMax = gStopLatency;
+            }
+        }
+#endif
+        break;
+    case CMD_QUERY:
+        gTelemetrySeqid = frame->seqid;
+        gTelemetryPending = 1;
+        break;
+    }
+}
+
+// the priority path: control frames skip the song frame queue and run
+// from the control tick, within a millisecond of their last byte
+void runControl(void)
+{
+    while (gControlHead != gControlTail) {
+        runCommand(&gControls[gControlHead & (CONTROL_QUEUE - 1)]);
+        gControlHead += 1;
+    }
+}
+
+// from the main loop, a blocking send would stall the control tick
+void sendTelemetry(void)
+{
+    if (!gTelemetryPending) {
+        return;
+    }
+    gTelemetryPending = 0;
+
+    MidiHeader header = {TLM_MAGIC, gTelemetrySeqid, {0}, sizeof(Telemetry)};
+    Telemetry telemetry;
+    telemetry.state = (gMidiCtx.status != DECODE_HEADER ? TLM_PLAYING : 0)
+                    | (gPaused ? TLM_PAUSED : 0) | (gStopping ? TLM_STOPPING : 0);
+    telemetry.seqid = gFrame.header.seqid;
+    telemetry.transpose = gTranspose;
+    telemetry.rate = gRate;
+    telemetry.position = gPosition;
+#ifdef MIDI_STATS
+    telemetry.stopLatency = gStopLatency;
+#else
+    telemetry.stopLatency = 0;
+#endif
+    Serial_SendArray((uint8_t *)&header, sizeof(header));
+    Serial_SendArray((uint8_t *)&telemetry, sizeof(telemetry));
+}
+
+// while a wait or a pause holds the decoder: a query is answered and the
+// next song's first frame parsed
+void onWaitIdle(void)
+{
+    sendTelemetry();
+    prefetchSong();
 }
 
 int main(void)
@@ -133,9 +1110,27 @@ int main(void)
     gDecodeFunc = decodeHeader;
     Serial_Init(onReadable);
     PWM_Init();
+#ifdef MIDI_STATS
+    DWT_Init();
+#endif
+#ifdef PWM_DMA_SEQ
+    SEQ_Init(onWaitIdle);
+    // the timers keep the time, bends are applied at event time, no
+    // vibrato, the tick only runs the control frames
+    delay_init(runControl);
+#else
+    delay_init(onControlTick);
+#endif
 
-    gMidiCtx.on_event = onMidiEvent;
-    gMidiCtx.on_complete = onMidiComplete;
+    initContext(&gMidiCtx);
+    voice_init(&gVoices, PWM_VOICE_NUM, VOICE_STEAL_LRU);
+    resetChannels();
+#ifdef MIDI_SKYLINE
+    skyline_init(&gSkyline, onSkylineEvent, 0);
+#endif
+#ifdef MIDI_LOOP
+    loop_init(&gLoop);
+#endif
 
     // Test C4 Scale Notes
 //    int _c[] = {262, 294, 330, 349, 392, 440, 494};
@@ -159,10 +1154,51 @@ int main(void)
     {
         if (gHasNewMessage) {
             LED_Flash();
-            int ret = midi_decode(&gMidiCtx, gMessage.payload, gMessage.header.payload_size);
-            while (ret != MIDI_OK);
+            uint8_t prefetched = gNextLen;
+            memcpy(&gFrame, &gMessage, sizeof(MidiHeader) + gMessage.header.payload_size);
+            gNextLen = 0;
             gHasNewMessage = 0;
-            Serial_SendByte(gMessage.header.seqid);
+            // acknowledged when taken, the host sends the next frame
+            // while this one plays
+            Serial_SendByte(gFrame.header.seqid);
+            if (gFrame.header.magic == (uint16_t)SEEK_MAGIC) {
+                seekPlayer(&gMidiCtx);
+            } else {
+                playFrame(prefetched);
+            }
+        }
+#ifdef MIDI_LOOP
+        if (gLoop.state == LOOP_PLAYING && !gStopping) {
+            if (gLoop.wrap) {
+                // notes across the end marker would hang over the wrap
+#ifdef MIDI_SKYLINE
+                skyline_flush(&gSkyline);
+                skyline_init(&gSkyline, onSkylineEvent, 0);
+#endif
+                for (uint8_t i = 0; i < VOICE_CHANNELS; ++i) {
+                    gChannels[i].sustain = 0;
+                    silenceChannel(i);
+                }
+            }
+            // a piece of the region per round, frames and a stop still come
+            // through; a broken region ends the song there
+            if (loop_play(&gLoop, &gMidiCtx) != MIDI_OK) {
+                resetPlayer(&gMidiCtx);
+            }
+            buzzerFlush();
+        }
+#endif
+        if (gStopping) {
+            // the voices are silent already, the next song frame starts a song
+#ifdef PWM_DMA_SEQ
+            SEQ_Reset();
+#endif
+            resetPlayer(&gMidiCtx);
+#ifndef PWM_DMA_SEQ
+            gDeadline = delay_now_us();
+#endif
+            gStopping = 0;
         }
+        sendTelemetry();
     }
 }
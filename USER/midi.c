@@ -3,12 +3,31 @@
 #include <string.h>
 
 #include "midi.h"
+#include "vlq.h"
+
+#ifdef MIDI_SINK
+// the consumer is bound at build time, a direct call the compiler may
+// inline with link time optimization; on_event only switches it on and off
+void MIDI_SINK(midi_context_t *ctx, midi_event_t *event);
+#define MIDI_EMIT(ctx, event) do { if ((ctx)->on_event) MIDI_SINK(ctx, event); } while (0)
+#else
+#define MIDI_EMIT(ctx, event) do { if ((ctx)->on_event) (ctx)->on_event(ctx, event); } while (0)
+#endif
+
+#ifdef MIDI_SINK_COMPLETE
+void MIDI_SINK_COMPLETE(midi_context_t *ctx);
+#define MIDI_COMPLETE(ctx) MIDI_SINK_COMPLETE(ctx)
+#else
+#define MIDI_COMPLETE(ctx) (ctx)->on_complete(ctx)
+#endif
 
 static inline int midi_be32toh(uint32_t d);
 static inline int midi_be16toh(uint16_t d);
 static inline int midi_number(uint8_t *buf, uint16_t *len, uint32_t *value);
 static int midi_decode_complete(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
 static int midi_decode_event_set_tempo(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
+static int midi_decode_event_marker(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
+static int midi_decode_event_meta(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
 static int midi_decode_event_drop(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
 static int midi_decode_event_non_channel(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
 static int midi_decode_event_param2(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
@@ -17,49 +36,112 @@ static int midi_decode_event_status(midi_context_t *ctx, uint8_t *buf, uint16_t
 static int midi_decode_event_delta(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
 static int midi_decode_track_header(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
 static int midi_decode_header(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
+static int midi_decode_header_fields(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
+static int midi_decode_chunk_skip(midi_context_t *ctx, uint8_t *buf, uint16_t *len);
+static void midi_end_track(midi_context_t *ctx);
 static inline void midi_process_event(midi_context_t *ctx, midi_event_t *event);
+static void midi_update_tempo(midi_context_t *ctx);
+
+// according to MIDI spec
+// time (in ms) = number_of_ticks * tempo / divisor * 1000
+// where tempo is expressed in microseconds per quarter note and
+// the divisor is expressed in MIDI ticks per quarter note
+// The division is done once per tempo or rate change, events only
+// multiply by the resulting Q16 microseconds per tick.
+// Do not use floating point, in some microcontrollers
+// floating point is slow or lacks precision.
+void midi_update_tempo(midi_context_t *ctx)
+{
+    uint32_t tpq = ctx->header.ticks_per_quarter;
+    uint32_t tempo = ctx->tempo;
 
-static inline void midi_process_event(midi_context_t *ctx, midi_event_t *event)
+    // tempo is 24 bits, scaled by the Q8 rate it still fits 32
+    if (ctx->rate && ctx->rate != MIDI_RATE_UNITY) {
+        tempo = (tempo << 8) / ctx->rate;
+    }
+
+    // (tempo << 16) / tpq in 32 bits, the remainder is below 2^15
+    uint32_t whole = tempo / tpq;
+    if (whole > 0xffff) {
+        ctx->us_per_tick = 0xffffffffu;
+    } else {
+        ctx->us_per_tick = (whole << 16) + ((tempo % tpq) << 16) / tpq;
+    }
+}
+
+void midi_set_rate(midi_context_t *ctx, uint16_t rate)
+{
+    ctx->rate = rate < MIDI_RATE_MIN ? MIDI_RATE_MIN : rate > MIDI_RATE_MAX ? MIDI_RATE_MAX : rate;
+    // before the header there is nothing to scale yet
+    if (ctx->tempo && ctx->header.ticks_per_quarter) {
+        midi_update_tempo(ctx);
+    }
+}
+
+static inline void midi_default_tempo(midi_context_t *ctx)
 {
     if (ctx->tempo == 0) {
         // Start with default "microseconds per quarter" according to midi standard
         ctx->tempo = 500000;
+        midi_update_tempo(ctx);
     }
+}
 
-    // according to MIDI spec
-    // time (in ms) = number_of_ticks * tempo / divisor * 1000
-    // where tempo is expressed in microseconds per quarter note and
-    // the divisor is expressed in MIDI ticks per quarter note
-    // Do the math in microseconds.
-    // Do not use floating point, in some microcontrollers
-    // floating point is slow or lacks precision.
-    event->delta = (event->delta * ctx->tempo + (ctx->header.ticks_per_quarter / 2)) / ctx->header.ticks_per_quarter;
+// the fraction of a microsecond is carried to the next conversion,
+// rounding never adds up over a song
+static inline uint32_t midi_ticks_to_us(midi_context_t *ctx, uint32_t ticks)
+{
+    uint64_t us = (uint64_t)ticks * ctx->us_per_tick + ctx->us_frac;
+    ctx->us_frac = (uint16_t)us;
+    return (uint32_t)(us >> 16);
+}
 
-    if (ctx->on_event) {
-        ctx->on_event(ctx, &ctx->track.event);
+// an event that is not handed out, its time goes to the next one that is
+static inline void midi_carry_delta(midi_context_t *ctx, midi_event_t *event)
+{
+    if (event->delta) {
+        midi_default_tempo(ctx);
+        ctx->pending_us += midi_ticks_to_us(ctx, event->delta);
     }
 }
 
-static inline int midi_number(uint8_t *buf, uint16_t *len, uint32_t *value)
+// a channel event of a channel or type the callback doesn't want
+static inline int midi_dropped(const midi_context_t *ctx, const midi_event_t *event)
 {
-    int ret = MIDI_OK;
-    uint16_t eat_len = 1;
-    uint8_t *p = buf;
+    return !event->is_meta && (((ctx->channel_drop >> (event->status & 0x0f))
+            | (ctx->type_drop >> ((event->status >> 4) & 7))) & 1);
+}
 
-    for (; p < (buf + *len); ++p, ++eat_len) {
-        *value = (*value << 7) | (*p & 0x7f);
-        if (*p < 0x80) {
-            break;
-        }
+static inline void midi_process_event(midi_context_t *ctx, midi_event_t *event)
+{
+    uint32_t us = ctx->pending_us;
+
+    midi_default_tempo(ctx);
+
+    // chords and controller bursts are runs of delta 0 and skip the math
+    if (event->delta) {
+        us += midi_ticks_to_us(ctx, event->delta);
     }
 
-    if (p == (buf + *len)) {
-        eat_len -= 1;
-        ret = MIDI_AGAIN;
+    if (midi_dropped(ctx, event)) {
+        ctx->pending_us = us;
+        return;
     }
 
-    *len = eat_len;
-    return ret;
+    ctx->pending_us = 0;
+    event->delta = us;
+    ctx->time_us += us;
+
+    MIDI_EMIT(ctx, &ctx->track.event);
+}
+
+static inline int midi_number(uint8_t *buf, uint16_t *len, uint32_t *value)
+{
+#ifdef MIDI_VLQ_WORD
+    return vlq_read_word(buf, len, value);
+#else
+    return vlq_read_bytes(buf, len, value);
+#endif
 }
 
 static inline int midi_be32toh(uint32_t d)
@@ -76,32 +158,105 @@ static inline int midi_be16toh(uint16_t d)
         ((d & 0xFF00) >> 8);
 }
 
+// the chunk headers up to MThd, an RMID file has RIFF ones before it
 int midi_decode_header(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
 {
-    int eat_len = MIN(MIDI_HEADER_LEN - ctx->tmp.buf_off, *len);
+    int eat_len = MIN(MIDI_CHUNK_HEADER_LEN - ctx->tmp.buf_off, *len);
     memcpy(&ctx->tmp.buf[ctx->tmp.buf_off], buf, eat_len);
     ctx->tmp.buf_off += eat_len;
     *len = eat_len;
-    if (ctx->tmp.buf_off < MIDI_HEADER_LEN) {
+    if (ctx->tmp.buf_off < MIDI_CHUNK_HEADER_LEN) {
         return MIDI_AGAIN;
     }
 
-    ctx->header.magic = *(uint32_t *)ctx->tmp.buf;
-    ctx->header.len = midi_be32toh(*(uint32_t *)(ctx->tmp.buf + 4));
-    ctx->header.format = midi_be16toh(*(uint16_t *)(ctx->tmp.buf + 8));
-    ctx->header.num_tracks = midi_be16toh(*(uint16_t *)(ctx->tmp.buf + 10));
-    ctx->header.ticks_per_quarter = midi_be16toh(*(uint16_t *)(ctx->tmp.buf + 12));
+    uint32_t magic = *(uint32_t *)ctx->tmp.buf;
+    uint32_t chunk_len = midi_be32toh(*(uint32_t *)(ctx->tmp.buf + 4));
+    ctx->chunk_end = ctx->offset + eat_len + chunk_len;
 
-    if (ctx->header.magic != MIDI_HEADER_MAGIC) {
-        LOG_ERROR("invalid midi header magic:0x%x", ctx->header.magic);
+    if (magic == MIDI_HEADER_MAGIC) {
+        if (chunk_len < MIDI_HEADER_FIELDS_LEN) {
+            LOG_ERROR("invalid midi header length:%u", chunk_len);
+            return MIDI_ABORT;
+        }
+        ctx->header.magic = magic;
+        ctx->header.len = chunk_len;
+        ctx->status = DECODE_HEADER_FIELDS;
+    } else if (magic == MIDI_RIFF_MAGIC) {
+        // "RIFF" and its length, then the 4 byte form type to skip
+        ctx->header.magic = magic;
+        ctx->chunk_end = ctx->offset + eat_len + 4;
+        ctx->status = DECODE_CHUNK_SKIP;
+    } else if (ctx->header.magic == MIDI_RIFF_MAGIC && magic == MIDI_RIFF_DATA_MAGIC) {
+        // the song is the body
+    } else if (ctx->header.magic == MIDI_RIFF_MAGIC) {
+        // RIFF lengths are little endian, chunks padded to even lengths
+        chunk_len = *(uint32_t *)(ctx->tmp.buf + 4);
+        ctx->chunk_end = ctx->offset + eat_len + chunk_len + (chunk_len & 1);
+        ctx->status = DECODE_CHUNK_SKIP;
+    } else {
+        LOG_ERROR("invalid midi header magic:0x%x", magic);
         return MIDI_ABORT;
     }
 
-    ctx->status = DECODE_TRACK_HEADER;
+    return MIDI_OK;
+}
+
+int midi_decode_header_fields(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
+{
+    int eat_len = MIN(MIDI_HEADER_FIELDS_LEN - ctx->tmp.buf_off, *len);
+    memcpy(&ctx->tmp.buf[ctx->tmp.buf_off], buf, eat_len);
+    ctx->tmp.buf_off += eat_len;
+    *len = eat_len;
+    if (ctx->tmp.buf_off < MIDI_HEADER_FIELDS_LEN) {
+        return MIDI_AGAIN;
+    }
+
+    ctx->header.format = midi_be16toh(*(uint16_t *)(ctx->tmp.buf));
+    ctx->header.num_tracks = midi_be16toh(*(uint16_t *)(ctx->tmp.buf + 2));
+    ctx->header.ticks_per_quarter = midi_be16toh(*(uint16_t *)(ctx->tmp.buf + 4));
+
+    // a longer header has fields this decoder doesn't know
+    ctx->status = DECODE_CHUNK_SKIP;
+
+    return MIDI_OK;
+}
+
+// Up to the end of the chunk by its length, whatever is in it: chunks
+// other than MTrk, bytes after END_OF_TRACK and the rest of a track that
+// failed to decode. A whole buffer at a time, no look at the bytes.
+int midi_decode_chunk_skip(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
+{
+    uint32_t left = ctx->chunk_end - ctx->offset;
+
+    if (*len < left) {
+        return MIDI_AGAIN;
+    }
+    *len = left;
+
+    if (ctx->header.magic != MIDI_HEADER_MAGIC) {
+        ctx->status = DECODE_HEADER;
+    } else if (ctx->decode_tracks_count == ctx->header.num_tracks) {
+        ctx->status = DECODE_COMPLETE;
+    } else {
+        ctx->status = DECODE_TRACK_HEADER;
+    }
 
     return MIDI_OK;
 }
 
+// END_OF_TRACK or the track's length is used up
+void midi_end_track(midi_context_t *ctx)
+{
+    ctx->decode_tracks_count += 1;
+
+    if (ctx->decode_tracks_count == ctx->header.num_tracks) {
+        // whatever follows the last track is not waited for
+        ctx->status = DECODE_COMPLETE;
+    } else {
+        ctx->status = DECODE_CHUNK_SKIP;
+    }
+}
+
 int midi_decode_track_header(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
 {
     int eat_len = MIN(MIDI_TRACK_HEADER_LEN - ctx->tmp.buf_off, *len);
@@ -115,13 +270,16 @@ int midi_decode_track_header(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
     midi_track_t *track = &ctx->track;
     track->magic = *(uint32_t *)(ctx->tmp.buf);
     track->len = midi_be32toh(*(uint32_t *)(ctx->tmp.buf + 4));
+    ctx->chunk_end = ctx->offset + eat_len + track->len;
 
     if (track->magic != MIDI_TRACK_HEADER_MAGIC) {
-        LOG_ERROR("invalid midi track header magic:0x%x", track->magic);
-        return MIDI_ABORT;
+        LOG_INFO("skip chunk magic:0x%x len:%u", track->magic, track->len);
+        ctx->status = DECODE_CHUNK_SKIP;
+        return MIDI_OK;
     }
 
     track->last_event_status_avail = 0;
+    ctx->tick = 0;
     ctx->status = DECODE_EVENT_DELTA;
 
     return MIDI_OK;
@@ -138,6 +296,7 @@ int midi_decode_event_delta(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
 
     event->delta = ctx->tmp.value;
     event->is_meta = 0;
+    ctx->tick += event->delta;
     ctx->status = DECODE_EVENT_STATUS;
 
     return MIDI_OK;
@@ -234,6 +393,11 @@ int midi_decode_event_non_channel(midi_context_t *ctx, uint8_t *buf, uint16_t *l
         return MIDI_AGAIN;
     }
 
+    // meta and sysex events are not handed out but markers, their time is
+    // kept until the next event handed out, which a marker is then
+    midi_carry_delta(ctx, event);
+    event->delta = 0;
+
     if (event->is_meta && event->status == END_OF_TRACK) {
         // 0xFF 0x2F 0x00
         if (ctx->tmp.total_len != 0) {
@@ -241,14 +405,7 @@ int midi_decode_event_non_channel(midi_context_t *ctx, uint8_t *buf, uint16_t *l
             return MIDI_ABORT;
         }
 
-        ctx->decode_tracks_count += 1;
-
-        if (ctx->decode_tracks_count == ctx->header.num_tracks) {
-            ctx->status = DECODE_COMPLETE;
-        } else {
-            ctx->status = DECODE_TRACK_HEADER;
-        }
-
+        midi_end_track(ctx);
         return MIDI_OK;
     }
 
@@ -261,11 +418,63 @@ int midi_decode_event_non_channel(midi_context_t *ctx, uint8_t *buf, uint16_t *l
         return MIDI_OK;
     }
 
+    if (event->is_meta && (event->status == MARKER || event->status == CUE_MARKER)) {
+        ctx->tmp.match = MIDI_LOOP_START | MIDI_LOOP_END;
+        ctx->status = DECODE_EVENT_MARKER;
+        return MIDI_AGAIN;
+    }
+
+#ifdef MIDI_NO_DATA
     ctx->status = DECODE_EVENT_DROP;
+#else
+    ctx->status = ctx->on_data ? DECODE_EVENT_DATA : DECODE_EVENT_DROP;
+#endif
 
     return MIDI_AGAIN;
 }
 
+#ifndef MIDI_NO_DATA
+// the bytes of a payload in this buffer, drop_len of it read before
+static void midi_slice(midi_context_t *ctx, const uint8_t *buf, uint16_t len)
+{
+    midi_slice_t slice;
+
+    slice.data = buf;
+    slice.len = len;
+    slice.offset = ctx->tmp.drop_len;
+    slice.total = ctx->tmp.total_len;
+    if (slice.offset != 0 || len != slice.total) {
+        // spans buffers, a short payload is put together
+        if (slice.total <= MIDI_DATA_STAGE) {
+            memcpy(&ctx->tmp.stage[slice.offset], buf, len);
+            if (slice.offset + len < slice.total) {
+                return;
+            }
+            slice.data = ctx->tmp.stage;
+            slice.len = slice.total;
+            slice.offset = 0;
+        }
+    }
+    ctx->on_data(ctx, &ctx->track.event, &slice);
+}
+#endif
+
+int midi_decode_event_data(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
+{
+    *len = MIN(ctx->tmp.total_len - ctx->tmp.drop_len, *len);
+#ifndef MIDI_NO_DATA
+    midi_slice(ctx, buf, *len);
+#endif
+    ctx->tmp.drop_len += *len;
+    if (ctx->tmp.drop_len < ctx->tmp.total_len) {
+        return MIDI_AGAIN;
+    }
+
+    ctx->status = DECODE_EVENT_DELTA;
+
+    return MIDI_OK;
+}
+
 int midi_decode_event_drop(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
 {
     *len = MIN(ctx->tmp.total_len - ctx->tmp.drop_len, *len);
@@ -293,8 +502,60 @@ int midi_decode_event_set_tempo(midi_context_t *ctx, uint8_t *buf, uint16_t *len
     tempo[0] = ctx->tmp.buf[2];
     tempo[1] = ctx->tmp.buf[1];
     tempo[2] = ctx->tmp.buf[0];
+    midi_update_tempo(ctx);
+
+    ctx->status = DECODE_EVENT_DELTA;
+    return MIDI_OK;
+}
+
+// the text is compared on the fly, no matter how the buffers cut it
+int midi_decode_event_marker(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
+{
+    static const char start[] = "loopstart";
+    static const char end[] = "loopend";
+    uint16_t i;
+
+    *len = MIN(ctx->tmp.total_len - ctx->tmp.drop_len, *len);
+#ifndef MIDI_NO_DATA
+    if (ctx->on_data) {
+        midi_slice(ctx, buf, *len);
+    }
+#endif
+    for (i = 0; i < *len; ++i) {
+        uint32_t pos = ctx->tmp.drop_len + i;
+        uint8_t c = buf[i] | 0x20;
+        if (pos >= sizeof(start) - 1 || c != start[pos]) {
+            ctx->tmp.match &= ~MIDI_LOOP_START;
+        }
+        if (pos >= sizeof(end) - 1 || c != end[pos]) {
+            ctx->tmp.match &= ~MIDI_LOOP_END;
+        }
+    }
+    ctx->tmp.drop_len += *len;
+    if (ctx->tmp.drop_len < ctx->tmp.total_len) {
+        return MIDI_AGAIN;
+    }
 
+    if (ctx->tmp.total_len != sizeof(start) - 1) {
+        ctx->tmp.match &= ~MIDI_LOOP_START;
+    }
+    if (ctx->tmp.total_len != sizeof(end) - 1) {
+        ctx->tmp.match &= ~MIDI_LOOP_END;
+    }
+    ctx->track.event.param1 = ctx->tmp.match;
+    ctx->track.event.param2 = 0;
+    ctx->status = DECODE_EVENT_META;
+    return MIDI_OK;
+}
+
+// A meta event read to its end, handed out without eating a byte: the
+// callback sees the context between two events, with the offset after
+// the meta event, so it may take a snapshot there.
+int midi_decode_event_meta(midi_context_t *ctx, uint8_t *buf, uint16_t *len)
+{
+    *len = 0;
     ctx->status = DECODE_EVENT_DELTA;
+    midi_process_event(ctx, &ctx->track.event);
     return MIDI_OK;
 }
 
@@ -314,6 +575,11 @@ midi_decode_func g_midi_decode_func[] = {
     midi_decode_event_non_channel,
     midi_decode_event_drop,
     midi_decode_event_set_tempo,
+    midi_decode_event_data,
+    midi_decode_event_marker,
+    midi_decode_event_meta,
+    midi_decode_header_fields,
+    midi_decode_chunk_skip,
     midi_decode_complete
 };
 
@@ -322,10 +588,35 @@ int midi_decode(midi_context_t *ctx, uint8_t *buf, uint16_t len)
     int ret = MIDI_OK;
     uint16_t off = 0;
     uint16_t _len = 0;
-    while (len > 0) {
+    // a meta event that ends the buffer is handed out right away
+    while (len > 0 || ctx->status == DECODE_EVENT_META) {
         _len = len;
+        if (ctx->status >= DECODE_EVENT_DELTA && ctx->status <= DECODE_EVENT_MARKER) {
+            // a track ends at its length, with or without END_OF_TRACK
+            uint32_t left = ctx->chunk_end - ctx->offset;
+            if (left == 0) {
+                LOG_ERROR("track %u ends without END_OF_TRACK", ctx->decode_tracks_count);
+                memset(&ctx->tmp, 0, sizeof(ctx->tmp));
+                midi_end_track(ctx);
+                continue;
+            }
+            if (_len > left) {
+                _len = left;
+            }
+        }
+
         ret = g_midi_decode_func[ctx->status](ctx, buf + off, &_len);
-        if (ret == MIDI_ABORT) {
+        if (ret == MIDI_ABORT && ctx->status >= DECODE_EVENT_DELTA && ctx->status <= DECODE_EVENT_MARKER) {
+            // a broken track costs its length, the next one plays
+            LOG_ERROR("skip the rest of track %u", ctx->decode_tracks_count);
+            memset(&ctx->tmp, 0, sizeof(ctx->tmp));
+            midi_end_track(ctx);
+            if (ctx->status == DECODE_CHUNK_SKIP) {
+                continue;
+            }
+            // the last track, the song is over
+            break;
+        } else if (ret == MIDI_ABORT) {
             return ret;
         }
 
@@ -333,9 +624,7 @@ int midi_decode(midi_context_t *ctx, uint8_t *buf, uint16_t len)
             memset(&ctx->tmp, 0, sizeof(ctx->tmp));
         }
 
-#ifndef NDEBUG
-        ctx->decode_len += _len;
-#endif
+        ctx->offset += _len;
 
         off += _len;
         len -= _len;
@@ -343,8 +632,112 @@ int midi_decode(midi_context_t *ctx, uint8_t *buf, uint16_t len)
 
     if (ctx->status == DECODE_COMPLETE && ctx->on_complete) {
         LOG_INFO("decode MIDI complete");
-        ctx->on_complete(ctx);
+        MIDI_COMPLETE(ctx);
     }
 
     return MIDI_OK;
 }
+
+int midi_snapshot(const midi_context_t *ctx, midi_checkpoint_t *cp)
+{
+    // a delta partly read sits in tmp, the time of events not handed
+    // out in pending_us
+    if (ctx->status != DECODE_EVENT_DELTA || ctx->tmp.value != 0 || ctx->pending_us != 0) {
+        return MIDI_AGAIN;
+    }
+
+    memset(cp, 0, sizeof(*cp));
+    cp->offset = ctx->offset;
+    cp->tick = ctx->tick;
+    cp->time_us = ctx->time_us;
+    cp->tempo = ctx->tempo;
+    cp->us_frac = ctx->us_frac;
+    cp->ticks_per_quarter = ctx->header.ticks_per_quarter;
+    cp->num_tracks = ctx->header.num_tracks;
+    cp->tracks_done = ctx->decode_tracks_count;
+    cp->chunk_end = ctx->chunk_end;
+    cp->running_status = ctx->track.last_event_status_avail ? ctx->track.last_event_status : 0;
+    return MIDI_OK;
+}
+
+void midi_restore(midi_context_t *ctx, const midi_checkpoint_t *cp)
+{
+    uint8_t i;
+
+    memset(&ctx->tmp, 0, sizeof(ctx->tmp));
+    ctx->header.magic = MIDI_HEADER_MAGIC;
+    ctx->header.ticks_per_quarter = cp->ticks_per_quarter;
+    ctx->header.num_tracks = cp->num_tracks;
+    ctx->decode_tracks_count = cp->tracks_done;
+    ctx->track.magic = MIDI_TRACK_HEADER_MAGIC;
+    ctx->track.last_event_status = cp->running_status;
+    ctx->track.last_event_status_avail = cp->running_status != 0;
+    ctx->offset = cp->offset;
+    ctx->chunk_end = cp->chunk_end;
+    ctx->tick = cp->tick;
+    ctx->time_us = cp->time_us;
+    ctx->tempo = cp->tempo;
+    ctx->us_frac = cp->us_frac;
+    ctx->pending_us = 0;
+    if (ctx->tempo) {
+        midi_update_tempo(ctx);
+    }
+    ctx->status = DECODE_EVENT_DELTA;
+
+    for (i = 0; i < MIDI_CHECKPOINT_NOTES; ++i) {
+        midi_event_t *event = &ctx->track.event;
+        if (cp->notes[i].status == 0) {
+            continue;
+        }
+        event->delta = 0;
+        event->status = cp->notes[i].status;
+        event->param1 = cp->notes[i].note;
+        event->param2 = cp->notes[i].velocity;
+        event->is_meta = 0;
+        if (!midi_dropped(ctx, event)) {
+            MIDI_EMIT(ctx, event);
+        }
+    }
+}
+
+int midi_scan_chunks(const uint8_t *buf, uint32_t size, midi_chunk_t *chunks, uint16_t max)
+{
+    uint32_t off = 0;
+    uint32_t end = size;
+    int count = 0;
+
+    if (size >= 12 && *(uint32_t *)buf == MIDI_RIFF_MAGIC) {
+        // RMID, the song is the body of the data chunk
+        for (off = 12; off + MIDI_CHUNK_HEADER_LEN <= size; ) {
+            // little endian, unlike the SMF chunks
+            uint32_t chunk_len = *(uint32_t *)(buf + off + 4);
+            off += MIDI_CHUNK_HEADER_LEN;
+            if (*(uint32_t *)(buf + off - MIDI_CHUNK_HEADER_LEN) == MIDI_RIFF_DATA_MAGIC) {
+                end = off + MIN(chunk_len, size - off);
+                break;
+            }
+            if (chunk_len >= size - off) {
+                return MIDI_ABORT;
+            }
+            off += chunk_len + (chunk_len & 1);
+        }
+    }
+
+    for (; off + MIDI_CHUNK_HEADER_LEN <= end; ++count) {
+        uint32_t magic = *(uint32_t *)(buf + off);
+        uint32_t chunk_len = midi_be32toh(*(uint32_t *)(buf + off + 4));
+        if (count == 0 && magic != MIDI_HEADER_MAGIC) {
+            return MIDI_ABORT;
+        }
+        if (count < max) {
+            chunks[count].magic = magic;
+            chunks[count].offset = off;
+            chunks[count].len = chunk_len;
+        }
+        // the last one may be cut short
+        off += MIDI_CHUNK_HEADER_LEN;
+        off += MIN(chunk_len, end - off);
+    }
+
+    return count;
+}
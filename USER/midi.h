@@ -1,16 +1,27 @@
+#ifndef __MIDI_H
+#define __MIDI_H
+
 #include <stdint.h>
-#include <math.h>
 
 #define MIDI_HEADER_MAGIC       0x6468544d
 #define MIDI_TRACK_HEADER_MAGIC 0x6b72544d
+#define MIDI_RIFF_MAGIC         0x46464952  // RMID files wrap the song in RIFF
+#define MIDI_RIFF_DATA_MAGIC    0x61746164  // the RIFF chunk holding the song
 
 #define MIDI_OK     0
 #define MIDI_AGAIN  -1
 #define MIDI_ABORT  -0xFF
 
 #define BUF_SIZE                32
+#define MIDI_RATE_UNITY         256     // Q8 playback speed, as written
+#define MIDI_RATE_MIN           32      // 1/8
+#define MIDI_RATE_MAX           2048    // 8x
+#define MIDI_CHECKPOINT_NOTES   4       // sounding notes a checkpoint brings back
 #define MIDI_HEADER_LEN         14U
 #define MIDI_TRACK_HEADER_LEN   8U
+#define MIDI_CHUNK_HEADER_LEN   8U  // magic and big endian length of any chunk
+#define MIDI_HEADER_FIELDS_LEN  6U  // format, tracks, division
+#define MIDI_DATA_STAGE         23U // payload bytes copied when it spans buffers, fits tmp
 
 #ifndef NDEBUG
 #define LOG_ERROR(fmt, ...) do {fprintf(stderr, "%s:%u -- "fmt"\n", __FILE__, __LINE__, ##__VA_ARGS__);} while (0)
@@ -62,6 +73,13 @@
 #define _FIRST_META_EVENT 0x00
 #define _LAST_META_EVENT 0x7f
 
+// bit of an event type in midi_context_t.type_drop, NOTE_OFF..PITCHWHEEL
+#define MIDI_TYPE_BIT(type) (1u << (((type) >> 4) & 7))
+
+// param1 of a MARKER or CUE_MARKER event, its text matched case insensitively
+#define MIDI_LOOP_START 0x01    // "loopStart"
+#define MIDI_LOOP_END   0x02    // "loopEnd"
+
 // Sysex/escape events
 #define SYSEX 0xf0
 #define ESCAPE 0xf7
@@ -76,6 +94,11 @@ typedef enum {
     DECODE_EVENT_NON_CHANNEL,
     DECODE_EVENT_DROP,
     DECODE_EVENT_SET_TEMPO,
+    DECODE_EVENT_DATA,
+    DECODE_EVENT_MARKER,
+    DECODE_EVENT_META,
+    DECODE_HEADER_FIELDS,
+    DECODE_CHUNK_SKIP,
     DECODE_COMPLETE
 } decode_status_t;
 
@@ -95,6 +118,48 @@ typedef struct {
     uint8_t is_meta;
 } midi_event_t;
 
+typedef struct {
+    uint8_t status;         // NOTE_ON | channel, 0 for an empty slot
+    uint8_t note;
+    uint8_t velocity;
+} __attribute__((packed)) midi_note_t;
+
+// Decoder state between two events, enough to carry on from offset.
+// Built on the host by a first pass (TOOLS/seek_index.c), sent to the
+// device as is, so it is packed and little endian on both sides.
+typedef struct {
+    uint32_t offset;        // file offset of the next event's delta
+    uint32_t tick;          // ticks into the track
+    uint32_t time_us;       // song time at the offset, wraps after 71 minutes
+    uint32_t tempo;
+    uint16_t us_frac;
+    uint16_t ticks_per_quarter;
+    uint16_t num_tracks;
+    uint16_t tracks_done;
+    uint32_t chunk_end;     // offset where the track ends
+    uint8_t running_status; // 0 for none
+    midi_note_t notes[MIDI_CHECKPOINT_NOTES];   // sounding at the offset
+} __attribute__((packed)) midi_checkpoint_t;
+
+// A meta or SysEx payload handed to on_data: the whole of it, or for a
+// payload longer than MIDI_DATA_STAGE that spans buffers, the piece in
+// one buffer. data points into the buffer given to midi_decode, or
+// into the context when a short payload was copied, and is only valid
+// during the call.
+typedef struct {
+    const uint8_t *data;
+    uint16_t len;
+    uint32_t offset;        // of data in the payload
+    uint32_t total;         // payload length
+} midi_slice_t;
+
+// a chunk of a file in memory, see midi_scan_chunks
+typedef struct {
+    uint32_t magic;
+    uint32_t offset;        // of the chunk header
+    uint32_t len;           // of the body, as declared
+} midi_chunk_t;
+
 typedef struct {
     uint32_t magic;
     uint32_t len;
@@ -106,22 +171,37 @@ typedef struct {
 struct midi_context;
 typedef void (*on_event_func)(struct midi_context *ctx, midi_event_t *event);
 typedef void (*on_complete_func)(struct midi_context *ctx);
+// event->status is the meta type, SYSEX or ESCAPE, its song time is
+// time_us + pending_us
+typedef void (*on_data_func)(struct midi_context *ctx, midi_event_t *event, const midi_slice_t *slice);
 typedef struct midi_context {
     midi_header_t header;
     midi_track_t track;
 
     uint32_t tempo;
+    uint32_t us_per_tick;   // Q16, follows tempo and rate
+    uint16_t rate;          // Q8 playback speed, 0 plays as written
+    uint16_t us_frac;       // Q16 remainder of the converted deltas
     uint32_t decode_tracks_count;
 
-#ifndef NDEBUG
-    uint32_t decode_len;
-#endif
+    uint32_t offset;        // bytes decoded
+    uint32_t chunk_end;     // offset after the chunk being decoded
+    uint32_t tick;          // ticks into the track
+    uint32_t time_us;       // converted deltas handed out
+    uint32_t pending_us;    // deltas of events not handed out, added to the next one
 
+    // channel events the callback doesn't want, bit n for channel n and
+    // MIDI_TYPE_BIT(type); they cost no call and their delta is kept
+    uint16_t channel_drop;
+    uint8_t type_drop;
 
     decode_status_t status;
 
     on_event_func on_event;
     on_complete_func on_complete;
+    // optional, the payloads of the meta events other than tempo and end
+    // of track and of SysEx; without it they are skipped unread
+    on_data_func on_data;
 
     void *user_data;
 
@@ -133,15 +213,26 @@ typedef struct midi_context {
         struct {
             uint32_t total_len;
             uint32_t drop_len;
+            uint8_t match;  // MIDI_LOOP_* names the marker text still matches
+            uint8_t stage[MIDI_DATA_STAGE];
         };
         uint32_t value;
     } tmp;
 } midi_context_t;
 
 int midi_decode(midi_context_t *ctx, uint8_t *buf, uint16_t len);
+// speed up or slow down from the next event on, MIDI_RATE_UNITY is as written
+void midi_set_rate(midi_context_t *ctx, uint16_t rate);
+// between two events only, MIDI_AGAIN inside one or while the time of
+// events not handed out is carried; leaves the notes empty
+int midi_snapshot(const midi_context_t *ctx, midi_checkpoint_t *cp);
+// carry on from cp->offset, the sounding notes of the checkpoint are
+// handed to on_event again as note ons with delta 0, set channel_drop and
+// type_drop before
+void midi_restore(midi_context_t *ctx, const midi_checkpoint_t *cp);
+// The chunks of a whole file in memory, inside the RIFF data chunk for
+// RMID, found by their lengths alone; a sender can skip all but MThd and
+// MTrk. Returns how many there are, up to max are stored, or MIDI_ABORT.
+int midi_scan_chunks(const uint8_t *buf, uint32_t size, midi_chunk_t *chunks, uint16_t max);
 
-static inline double midi_note_to_freq(uint8_t note)
-{
-    double n = note;
-    return 440 * pow(2, (n-69)/12);
-}
\ No newline at end of file
+#endif
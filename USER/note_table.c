@@ -0,0 +1,153 @@
+// generated by TOOLS/gen_note_table.c, do not edit
+
+#include "note_table.h"
+
+const note_period_t note_periods[128] = {
+    {  134, 65232},   //   0 8.176Hz
+    {  126, 65449},   //   1 8.662Hz
+    {  119, 65380},   //   2 9.177Hz
+    {  112, 65533},   //   3 9.723Hz
+    {  106, 65323},   //   4 10.301Hz
+    {  100, 65320},   //   5 10.913Hz
+    {   95, 64865},   //   6 11.562Hz
+    {   89, 65306},   //   7 12.250Hz
+    {   84, 65266},   //   8 12.978Hz
+    {   79, 65454},   //   9 13.750Hz
+    {   75, 65031},   //  10 14.568Hz
+    {   71, 64792},   //  11 15.434Hz
+    {   67, 64753},   //  12 16.352Hz
+    {   63, 64938},   //  13 17.324Hz
+    {   59, 65380},   //  14 18.354Hz
+    {   56, 64958},   //  15 19.445Hz
+    {   53, 64719},   //  16 20.602Hz
+    {   50, 64679},   //  17 21.827Hz
+    {   47, 64865},   //  18 23.125Hz
+    {   44, 65306},   //  19 24.500Hz
+    {   42, 64508},   //  20 25.957Hz
+    {   39, 65454},   //  21 27.500Hz
+    {   37, 65031},   //  22 29.135Hz
+    {   35, 64792},   //  23 30.868Hz
+    {   33, 64753},   //  24 32.703Hz
+    {   31, 64938},   //  25 34.648Hz
+    {   29, 65380},   //  26 36.708Hz
+    {   28, 63838},   //  27 38.891Hz
+    {   26, 64719},   //  28 41.203Hz
+    {   25, 63436},   //  29 43.654Hz
+    {   23, 64865},   //  30 46.249Hz
+    {   22, 63886},   //  31 48.999Hz
+    {   21, 63041},   //  32 51.913Hz
+    {   19, 65454},   //  33 55.000Hz
+    {   18, 65031},   //  34 58.270Hz
+    {   17, 64792},   //  35 61.735Hz
+    {   16, 64753},   //  36 65.406Hz
+    {   15, 64938},   //  37 69.296Hz
+    {   14, 65380},   //  38 73.416Hz
+    {   14, 61710},   //  39 77.782Hz
+    {   13, 62407},   //  40 82.407Hz
+    {   12, 63436},   //  41 87.307Hz
+    {   11, 64865},   //  42 92.499Hz
+    {   11, 61224},   //  43 97.999Hz
+    {   10, 63041},   //  44 103.826Hz
+    {    9, 65454},   //  45 110.000Hz
+    {    9, 61780},   //  46 116.541Hz
+    {    8, 64792},   //  47 123.471Hz
+    {    8, 61155},   //  48 130.813Hz
+    {    7, 64938},   //  49 138.591Hz
+    {    7, 61293},   //  50 146.832Hz
+    {    7, 57853},   //  51 155.563Hz
+    {    6, 62407},   //  52 164.814Hz
+    {    6, 58904},   //  53 174.614Hz
+    {    5, 64865},   //  54 184.997Hz
+    {    5, 61224},   //  55 195.998Hz
+    {    5, 57788},   //  56 207.652Hz
+    {    4, 65454},   //  57 220.000Hz
+    {    4, 61780},   //  58 233.082Hz
+    {    4, 58312},   //  59 246.942Hz
+    {    4, 55039},   //  60 261.626Hz
+    {    3, 64938},   //  61 277.183Hz
+    {    3, 61293},   //  62 293.665Hz
+    {    3, 57853},   //  63 311.127Hz
+    {    3, 54606},   //  64 329.628Hz
+    {    3, 51541},   //  65 349.228Hz
+    {    2, 64865},   //  66 369.994Hz
+    {    2, 61224},   //  67 391.995Hz
+    {    2, 57788},   //  68 415.305Hz
+    {    2, 54544},   //  69 440.000Hz
+    {    2, 51483},   //  70 466.164Hz
+    {    2, 48593},   //  71 493.883Hz
+    {    2, 45866},   //  72 523.251Hz
+    {    1, 64938},   //  73 554.365Hz
+    {    1, 61293},   //  74 587.330Hz
+    {    1, 57853},   //  75 622.254Hz
+    {    1, 54606},   //  76 659.255Hz
+    {    1, 51541},   //  77 698.456Hz
+    {    1, 48648},   //  78 739.989Hz
+    {    1, 45918},   //  79 783.991Hz
+    {    1, 43341},   //  80 830.609Hz
+    {    1, 40908},   //  81 880.000Hz
+    {    1, 38612},   //  82 932.328Hz
+    {    1, 36445},   //  83 987.767Hz
+    {    1, 34399},   //  84 1046.502Hz
+    {    0, 64938},   //  85 1108.731Hz
+    {    0, 61293},   //  86 1174.659Hz
+    {    0, 57853},   //  87 1244.508Hz
+    {    0, 54606},   //  88 1318.510Hz
+    {    0, 51541},   //  89 1396.913Hz
+    {    0, 48648},   //  90 1479.978Hz
+    {    0, 45918},   //  91 1567.982Hz
+    {    0, 43341},   //  92 1661.219Hz
+    {    0, 40908},   //  93 1760.000Hz
+    {    0, 38612},   //  94 1864.655Hz
+    {    0, 36445},   //  95 1975.533Hz
+    {    0, 34399},   //  96 2093.005Hz
+    {    0, 32469},   //  97 2217.461Hz
+    {    0, 30646},   //  98 2349.318Hz
+    {    0, 28926},   //  99 2489.016Hz
+    {    0, 27303},   // 100 2637.020Hz
+    {    0, 25770},   // 101 2793.826Hz
+    {    0, 24324},   // 102 2959.955Hz
+    {    0, 22958},   // 103 3135.963Hz
+    {    0, 21670},   // 104 3322.438Hz
+    {    0, 20454},   // 105 3520.000Hz
+    {    0, 19306},   // 106 3729.310Hz
+    {    0, 18222},   // 107 3951.066Hz
+    {    0, 17199},   // 108 4186.009Hz
+    {    0, 16234},   // 109 4434.922Hz
+    {    0, 15323},   // 110 4698.636Hz
+    {    0, 14463},   // 111 4978.032Hz
+    {    0, 13651},   // 112 5274.041Hz
+    {    0, 12885},   // 113 5587.652Hz
+    {    0, 12161},   // 114 5919.911Hz
+    {    0, 11479},   // 115 6271.927Hz
+    {    0, 10834},   // 116 6644.875Hz
+    {    0, 10226},   // 117 7040.000Hz
+    {    0,  9652},   // 118 7458.620Hz
+    {    0,  9110},   // 119 7902.133Hz
+    {    0,  8599},   // 120 8372.018Hz
+    {    0,  8116},   // 121 8869.844Hz
+    {    0,  7661},   // 122 9397.273Hz
+    {    0,  7231},   // 123 9956.063Hz
+    {    0,  6825},   // 124 10548.082Hz
+    {    0,  6442},   // 125 11175.303Hz
+    {    0,  6080},   // 126 11839.822Hz
+    {    0,  5739},   // 127 12543.854Hz
+};
+
+const uint8_t note_fold[NOTE_FOLD_SIZE] = {
+     80,  81,  82,  83,  72,  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,   // -64..-49
+     72,  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,  72,  73,  74,  75,   // -48..-33
+     76,  77,  78,  79,  80,  81,  82,  83,  72,  73,  74,  75,  76,  77,  78,  79,   // -32..-17
+     80,  81,  82,  83,  72,  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,   // -16..-1
+     72,  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,  72,  73,  74,  75,   // 0..15
+     76,  77,  78,  79,  80,  81,  82,  83,  72,  73,  74,  75,  76,  77,  78,  79,   // 16..31
+     80,  81,  82,  83,  72,  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,   // 32..47
+     72,  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,  72,  73,  74,  75,   // 48..63
+     76,  77,  78,  79,  80,  81,  82,  83,  72,  73,  74,  75,  76,  77,  78,  79,   // 64..79
+     80,  81,  82,  83,  84,  85,  86,  87,  88,  89,  90,  91,  92,  93,  94,  95,   // 80..95
+     96,  97,  98,  99, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111,   // 96..111
+    100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 100, 101, 102, 103,   // 112..127
+    104, 105, 106, 107, 108, 109, 110, 111, 100, 101, 102, 103, 104, 105, 106, 107,   // 128..143
+    108, 109, 110, 111, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111,   // 144..159
+    100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 100, 101, 102, 103,   // 160..175
+    104, 105, 106, 107, 108, 109, 110, 111, 100, 101, 102, 103, 104, 105, 106, 107,   // 176..191
+};
@@ -0,0 +1,31 @@
+#ifndef __NOTE_TABLE_H
+#define __NOTE_TABLE_H
+
+#include <stdint.h>
+
+// timer prescaler/autoreload of every MIDI note for the 72MHz timer clock,
+// the note sounds at 72MHz / ((prescaler+1) * (autoreload+1))
+typedef struct {
+    uint16_t prescaler;
+    uint16_t autoreload;
+} note_period_t;
+
+extern const note_period_t note_periods[128];
+
+// passive buzzers are loud from about 500Hz to 5kHz, C5 to D#8
+#define NOTE_RANGE_LOW      72
+#define NOTE_RANGE_HIGH     111
+// transposed notes from -64 to 191, moved by octaves into the range
+#define NOTE_FOLD_OFFSET    64
+#define NOTE_FOLD_SIZE      256
+#define NOTE_TRANSPOSE_MAX  64
+
+extern const uint8_t note_fold[NOTE_FOLD_SIZE];
+
+// transpose within +-NOTE_TRANSPOSE_MAX
+static inline uint8_t note_fold_lookup(uint8_t note, int8_t transpose)
+{
+    return note_fold[(uint8_t)((note & 0x7f) + transpose + NOTE_FOLD_OFFSET)];
+}
+
+#endif
@@ -0,0 +1,35 @@
+#include "pitch.h"
+
+// 2^(-i/192) in Q16, i = 0..16 covers one semitone in 1/16 steps
+static const uint32_t pitch_frac[17] = {
+    65536, 65300, 65065, 64830, 64596, 64364, 64132, 63901, 63670,
+    63441, 63212, 62984, 62757, 62531, 62306, 62081, 61858
+};
+
+void pitch_to_period(int32_t pitch, note_period_t *period)
+{
+    if (pitch < 0) {
+        pitch = 0;
+    } else if (pitch > PITCH_NOTE(127)) {
+        pitch = PITCH_NOTE(127);
+    }
+
+    const note_period_t *base = &note_periods[pitch >> 8];
+    uint32_t frac = pitch & 0xff;
+    if (frac == 0) {
+        *period = *base;
+        return;
+    }
+
+    // linear interpolation between two 1/16 semitone points
+    uint32_t i = frac >> 4;
+    uint32_t factor = pitch_frac[i] - (((pitch_frac[i] - pitch_frac[i + 1]) * (frac & 0x0f)) >> 4);
+
+    // the period in timer clocks, up to 2^32 for the lowest notes
+    uint32_t ticks = (uint32_t)(((uint64_t)(base->prescaler + 1) * (base->autoreload + 1) * factor) >> 16);
+
+    // smallest prescaler that keeps the autoreload in 16 bits
+    uint32_t prescaler = (ticks - 1) >> 16;
+    period->prescaler = prescaler;
+    period->autoreload = ticks / (prescaler + 1) - 1;
+}
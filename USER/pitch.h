@@ -0,0 +1,16 @@
+#ifndef __PITCH_H
+#define __PITCH_H
+
+#include <stdint.h>
+
+#include "note_table.h"
+
+// pitch in 1/256 semitone, MIDI note n is n << 8
+#define PITCH_NOTE(n) ((int32_t)(n) << 8)
+
+// timer prescaler/autoreload for any pitch between note 0 and note 127,
+// integer only: the note table gives the semitone, a Q16 table of
+// 2^(-x/12) interpolated in 1/16 semitone steps gives the fraction
+void pitch_to_period(int32_t pitch, note_period_t *period);
+
+#endif
@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "skyline.h"
+
+static inline int skyline_melodic(const midi_event_t *event)
+{
+    uint8_t type = event->status & 0xf0;
+    return !event->is_meta && (type == NOTE_ON || type == NOTE_OFF)
+        && (event->status & 0x0f) != SKYLINE_PASS;
+}
+
+static inline int skyline_note_on(const midi_event_t *event)
+{
+    return (event->status & 0xf0) == NOTE_ON && event->param2 > 0;
+}
+
+static void skyline_emit(skyline_t *sk, uint32_t time, const midi_event_t *event)
+{
+    midi_event_t out = *event;
+    out.delta = time - sk->out_time;
+    sk->out_time = time;
+    sk->output(sk->user, &out);
+}
+
+static void skyline_emit_note(skyline_t *sk, uint32_t time, uint8_t status, uint8_t note, uint8_t velocity)
+{
+    midi_event_t event;
+    memset(&event, 0, sizeof(event));
+    event.status = status;
+    event.param1 = note;
+    event.param2 = velocity;
+    skyline_emit(sk, time, &event);
+}
+
+// the same channel follows its own highest note, another channel has
+// to clear the hysteresis so crossing parts don't flip the line
+static int skyline_wins(const skyline_t *sk, uint8_t channel, uint8_t note)
+{
+    if (!sk->line_active) {
+        return 1;
+    }
+    return note >= sk->line_note + (channel == sk->line_channel ? 0 : SKYLINE_HYSTERESIS);
+}
+
+static void skyline_start(skyline_t *sk, uint32_t time, uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    if (sk->line_active) {
+        skyline_emit_note(sk, time, NOTE_OFF | sk->line_channel, sk->line_note, 0);
+    }
+    skyline_emit_note(sk, time, NOTE_ON | channel, note, velocity);
+    sk->line_active = 1;
+    sk->line_channel = channel;
+    sk->line_note = note;
+}
+
+static void skyline_recent_add(skyline_t *sk, uint32_t time, const midi_event_t *event)
+{
+    skyline_note_t *r = &sk->recent[sk->recent_next];
+    sk->recent_next = (sk->recent_next + 1) % SKYLINE_RECENT;
+    r->time = time;
+    r->channel = event->status & 0x0f;
+    r->note = event->param1;
+    r->velocity = event->param2;
+    r->held = 1;
+}
+
+static void skyline_recent_release(skyline_t *sk, uint8_t channel, uint8_t note)
+{
+    uint8_t i;
+    for (i = 0; i < SKYLINE_RECENT; ++i) {
+        skyline_note_t *r = &sk->recent[i];
+        if (r->held && r->channel == channel && r->note == note) {
+            r->held = 0;
+        }
+    }
+}
+
+// the line ended, a note that started a moment ago and is still held
+// takes over, e.g. the next melody note of a legato overlap
+static void skyline_resume(skyline_t *sk, uint32_t time)
+{
+    skyline_note_t *best = NULL;
+    uint8_t i;
+
+    for (i = 0; i < SKYLINE_RECENT; ++i) {
+        skyline_note_t *r = &sk->recent[i];
+        if (r->held && time - r->time <= SKYLINE_RESUME_US && (best == NULL || r->note > best->note)) {
+            best = r;
+        }
+    }
+    if (best) {
+        skyline_start(sk, time, best->channel, best->note, best->velocity);
+    }
+}
+
+static void skyline_pop(skyline_t *sk)
+{
+    skyline_entry_t entry = sk->queue[sk->head];
+    midi_event_t *event = &entry.event;
+    uint8_t channel = event->status & 0x0f;
+    uint8_t i;
+
+    sk->head = (sk->head + 1) % SKYLINE_QUEUE;
+    sk->count -= 1;
+
+    if (!skyline_melodic(event)) {
+        skyline_emit(sk, entry.time, event);
+        return;
+    }
+
+    if (skyline_note_on(event)) {
+        skyline_recent_add(sk, entry.time, event);
+
+        // a higher onset of the same chord is coming and will take the
+        // line, leave it to it; one the hysteresis keeps out doesn't count
+        for (i = 0; i < sk->count; ++i) {
+            const skyline_entry_t *next = &sk->queue[(sk->head + i) % SKYLINE_QUEUE];
+            if (next->time - entry.time > SKYLINE_WINDOW_US) {
+                break;
+            }
+            if (skyline_melodic(&next->event) && skyline_note_on(&next->event)
+                    && next->event.param1 > event->param1
+                    && skyline_wins(sk, next->event.status & 0x0f, next->event.param1)) {
+                sk->dropped_count += 1;
+                return;
+            }
+        }
+
+        if (skyline_wins(sk, channel, event->param1)) {
+            skyline_start(sk, entry.time, channel, event->param1, event->param2);
+            sk->kept_count += 1;
+        } else {
+            sk->dropped_count += 1;
+        }
+        return;
+    }
+
+    // note off, only the line's own one is heard
+    skyline_recent_release(sk, channel, event->param1);
+    if (sk->line_active && sk->line_channel == channel && sk->line_note == event->param1) {
+        skyline_emit(sk, entry.time, event);
+        sk->line_active = 0;
+        skyline_resume(sk, entry.time);
+    }
+}
+
+void skyline_init(skyline_t *sk, skyline_output_func output, void *user)
+{
+    memset(sk, 0, sizeof(*sk));
+    sk->output = output;
+    sk->user = user;
+}
+
+void skyline_push(skyline_t *sk, const midi_event_t *event)
+{
+    if (sk->count == SKYLINE_QUEUE) {
+        // more events than the window holds, decide with what there is
+        skyline_pop(sk);
+    }
+
+    sk->now += event->delta;
+    skyline_entry_t *entry = &sk->queue[(sk->head + sk->count) % SKYLINE_QUEUE];
+    entry->time = sk->now;
+    entry->event = *event;
+    sk->count += 1;
+
+    while (sk->count && sk->now - sk->queue[sk->head].time > SKYLINE_WINDOW_US) {
+        skyline_pop(sk);
+    }
+}
+
+void skyline_flush(skyline_t *sk)
+{
+    while (sk->count) {
+        skyline_pop(sk);
+    }
+    if (sk->line_active) {
+        skyline_emit_note(sk, sk->out_time, NOTE_OFF | sk->line_channel, sk->line_note, 0);
+        sk->line_active = 0;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef __SKYLINE_H
+#define __SKYLINE_H
+
+#include <stdint.h>
+
+#include "midi.h"
+
+// Streaming skyline: reduces the melodic channels to a single line that
+// follows the highest note, the drum channel and all the other events
+// pass through. Events are held back for a lookahead window so a chord
+// is judged as a whole, the memory is bounded by the queue.
+
+#define SKYLINE_QUEUE       16      // events in the lookahead window
+#define SKYLINE_RECENT      8       // note ons remembered for the resume
+#define SKYLINE_WINDOW_US   30000   // onsets this close are one chord
+#define SKYLINE_RESUME_US   150000  // a held note this young takes over an ended line
+#define SKYLINE_HYSTERESIS  3       // semitones another channel must be above the line
+#define SKYLINE_PASS        9       // drum channel, never reduced
+
+typedef void (*skyline_output_func)(void *user, midi_event_t *event);
+
+typedef struct {
+    uint32_t time;
+    midi_event_t event;
+} skyline_entry_t;
+
+typedef struct {
+    uint32_t time;
+    uint8_t channel;
+    uint8_t note;
+    uint8_t velocity;
+    uint8_t held;
+} skyline_note_t;
+
+typedef struct {
+    skyline_entry_t queue[SKYLINE_QUEUE];
+    uint8_t head;
+    uint8_t count;
+
+    skyline_note_t recent[SKYLINE_RECENT];
+    uint8_t recent_next;
+
+    uint32_t now;           // time of the last input event, us
+    uint32_t out_time;      // time of the last output event, us
+
+    // the note the line plays
+    uint8_t line_active;
+    uint8_t line_channel;
+    uint8_t line_note;
+
+    skyline_output_func output;
+    void *user;
+
+    uint32_t kept_count;    // melodic note ons that made it to the line
+    uint32_t dropped_count;
+} skyline_t;
+
+void skyline_init(skyline_t *sk, skyline_output_func output, void *user);
+// event->delta in us, as the decoder hands it out
+void skyline_push(skyline_t *sk, const midi_event_t *event);
+// end of the song, emit what is still queued and end the line
+void skyline_flush(skyline_t *sk);
+
+#endif
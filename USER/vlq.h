@@ -0,0 +1,72 @@
+#ifndef __VLQ_H
+#define __VLQ_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "midi.h"
+
+// Variable length quantities of delta times and event lengths, 7 bits a
+// byte, the top bit set on all but the last. Both readers take what is
+// left of the buffer in *len and the value read so far in *value (0 at
+// the start, it carries over when a buffer ends inside a number); they
+// return MIDI_OK with the bytes eaten in *len, or MIDI_AGAIN with *len
+// all eaten when the number goes on in the next buffer.
+
+// a byte at a time, what the device uses
+static inline int vlq_read_bytes(const uint8_t *buf, uint16_t *len, uint32_t *value)
+{
+    int ret = MIDI_OK;
+    uint16_t eat_len = 1;
+    const uint8_t *p = buf;
+
+    for (; p < (buf + *len); ++p, ++eat_len) {
+        *value = (*value << 7) | (*p & 0x7f);
+        if (*p < 0x80) {
+            break;
+        }
+    }
+
+    if (p == (buf + *len)) {
+        eat_len -= 1;
+        ret = MIDI_AGAIN;
+    }
+
+    *len = eat_len;
+    return ret;
+}
+
+// Four bytes at a time: the last byte is the first one with the top bit
+// clear, its groups are moved together with shifts and masks. Numbers
+// that go past the buffer or past 4 bytes (not valid SMF) take the byte
+// loop. Little endian only; midi.c uses it when built with MIDI_VLQ_WORD.
+static inline int vlq_read_word(const uint8_t *buf, uint16_t *len, uint32_t *value)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32_t word, last, x;
+    uint16_t n;
+
+    // most deltas are 0 or short, one byte decides
+    if (*len > 0 && buf[0] < 0x80) {
+        *value = (*value << 7) | buf[0];
+        *len = 1;
+        return MIDI_OK;
+    }
+    if (*len >= 4) {
+        memcpy(&word, buf, 4);
+        last = ~word & 0x80808080u;
+        if (last) {
+            n = (__builtin_ctz(last) >> 3) + 1;
+            // the first byte is the highest group, bytes after the last out
+            x = __builtin_bswap32(word & 0x7f7f7f7fu) >> (32 - 8 * n);
+            x = (x & 0x7f) | ((x >> 1) & 0x3f80) | ((x >> 2) & 0x1fc000) | ((x >> 3) & 0xfe00000);
+            *value = (*value << (7 * n)) | x;
+            *len = n;
+            return MIDI_OK;
+        }
+    }
+#endif
+    return vlq_read_bytes(buf, len, value);
+}
+
+#endif
@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "voice.h"
+
+static inline void voice_note_set(voice_allocator_t *va, uint8_t channel, uint8_t note)
+{
+    va->notes[channel & 0x0f][(note >> 5) & 3] |= 1u << (note & 31);
+}
+
+static inline void voice_note_clear(voice_allocator_t *va, uint8_t channel, uint8_t note)
+{
+    va->notes[channel & 0x0f][(note >> 5) & 3] &= ~(1u << (note & 31));
+}
+
+static int voice_find(voice_allocator_t *va, uint8_t channel, uint8_t note)
+{
+    uint8_t i;
+    for (i = 0; i < va->num_voices; ++i) {
+        voice_t *v = &va->voices[i];
+        if (v->active && v->channel == channel && v->note == note) {
+            return i;
+        }
+    }
+    return VOICE_NONE;
+}
+
+// pick the voice to give up according to the policy,
+// ties are broken by age so the result is deterministic
+static int voice_victim(voice_allocator_t *va, uint8_t note, uint8_t velocity)
+{
+    uint8_t i;
+    int victim = 0;
+    voice_t *voices = va->voices;
+
+    for (i = 1; i < va->num_voices; ++i) {
+        voice_t *v = &voices[i];
+        voice_t *w = &voices[victim];
+        switch (va->policy) {
+        case VOICE_STEAL_LOWEST_VELOCITY:
+            if (v->velocity < w->velocity || (v->velocity == w->velocity && v->stamp < w->stamp)) {
+                victim = i;
+            }
+            break;
+        case VOICE_STEAL_HIGHEST_NOTE:
+            if (v->note < w->note || (v->note == w->note && v->stamp < w->stamp)) {
+                victim = i;
+            }
+            break;
+        case VOICE_STEAL_LRU:
+        default:
+            if (v->stamp < w->stamp) {
+                victim = i;
+            }
+            break;
+        }
+    }
+
+    // the new note loses against every sounding one
+    if (va->policy == VOICE_STEAL_LOWEST_VELOCITY && velocity < voices[victim].velocity) {
+        return VOICE_NONE;
+    }
+    if (va->policy == VOICE_STEAL_HIGHEST_NOTE && note < voices[victim].note) {
+        return VOICE_NONE;
+    }
+
+    return victim;
+}
+
+void voice_init(voice_allocator_t *va, uint8_t num_voices, voice_steal_policy_t policy)
+{
+    memset(va, 0, sizeof(*va));
+    va->num_voices = num_voices > VOICE_MAX ? VOICE_MAX : num_voices;
+    va->policy = policy;
+}
+
+int voice_note_on(voice_allocator_t *va, uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    int i = VOICE_NONE;
+
+    va->note_on_count += 1;
+
+    // retrigger of a sounding note keeps its voice
+    if (voice_note_test(va, channel, note)) {
+        i = voice_find(va, channel, note);
+    }
+
+    if (i == VOICE_NONE) {
+        for (i = 0; i < va->num_voices; ++i) {
+            if (!va->voices[i].active) {
+                break;
+            }
+        }
+    }
+
+    if (i == va->num_voices) {
+        i = voice_victim(va, note, velocity);
+        if (i == VOICE_NONE) {
+            va->dropped_count += 1;
+            return VOICE_NONE;
+        }
+        va->stolen_count += 1;
+        voice_note_clear(va, va->voices[i].channel, va->voices[i].note);
+    }
+
+    voice_t *v = &va->voices[i];
+    v->active = 1;
+    v->channel = channel;
+    v->note = note;
+    v->velocity = velocity;
+    v->stamp = ++va->clock;
+    voice_note_set(va, channel, note);
+
+    return i;
+}
+
+int voice_note_off(voice_allocator_t *va, uint8_t channel, uint8_t note)
+{
+    if (!voice_note_test(va, channel, note)) {
+        return VOICE_NONE;
+    }
+
+    int i = voice_find(va, channel, note);
+    if (i != VOICE_NONE) {
+        va->voices[i].active = 0;
+    }
+    voice_note_clear(va, channel, note);
+
+    return i;
+}
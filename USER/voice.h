@@ -0,0 +1,51 @@
+#ifndef __VOICE_H
+#define __VOICE_H
+
+#include <stdint.h>
+
+#define VOICE_MAX       4
+#define VOICE_NONE      -1
+#define VOICE_CHANNELS  16
+
+typedef enum {
+    VOICE_STEAL_LRU = 0,            // steal the voice that started first
+    VOICE_STEAL_LOWEST_VELOCITY,    // steal the quietest voice, drop quieter new notes
+    VOICE_STEAL_HIGHEST_NOTE,       // keep the highest notes, drop lower new notes
+    VOICE_STEAL_POLICY_NUM
+} voice_steal_policy_t;
+
+typedef struct {
+    uint8_t active;
+    uint8_t channel;
+    uint8_t note;
+    uint8_t velocity;
+    uint32_t stamp;     // allocation order, for LRU
+} voice_t;
+
+typedef struct {
+    voice_t voices[VOICE_MAX];
+    uint8_t num_voices;
+    voice_steal_policy_t policy;
+    uint32_t clock;
+
+    // one bit per (channel, note) that currently owns a voice,
+    // lets NOTE_OFF of a stolen or dropped note bail out without a scan
+    uint32_t notes[VOICE_CHANNELS][4];
+
+    uint32_t note_on_count;
+    uint32_t stolen_count;  // notes cut off by a newer note
+    uint32_t dropped_count; // notes that never got a voice
+} voice_allocator_t;
+
+void voice_init(voice_allocator_t *va, uint8_t num_voices, voice_steal_policy_t policy);
+// returns the voice the note should be played on, or VOICE_NONE when it's dropped
+int voice_note_on(voice_allocator_t *va, uint8_t channel, uint8_t note, uint8_t velocity);
+// returns the voice to silence, or VOICE_NONE when the note isn't sounding
+int voice_note_off(voice_allocator_t *va, uint8_t channel, uint8_t note);
+
+static inline int voice_note_test(voice_allocator_t *va, uint8_t channel, uint8_t note)
+{
+    return (va->notes[channel & 0x0f][(note >> 5) & 3] >> (note & 31)) & 1;
+}
+
+#endif